@@ -0,0 +1,154 @@
+
+#pragma once
+
+#include <rpp/base.h>
+
+#include "fwd.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+// Collects pipeline barriers and records them with one vkCmdPipelineBarrier2, which lets the
+// driver merge the transitions. Barriers for the same buffer range or image subresources with
+// the same layouts are combined by merging their masks, and all global barriers are combined
+// into one. Barriers of one flush are not ordered against each other, so a subresource may
+// only change layout once per flush.
+template<typename A = Alloc>
+struct Barriers {
+
+    Barriers() = default;
+    ~Barriers() = default;
+
+    Barriers(const Barriers&) = delete;
+    Barriers& operator=(const Barriers&) = delete;
+    Barriers(Barriers&&) = default;
+    Barriers& operator=(Barriers&&) = default;
+
+    bool empty() const {
+        return memory_barriers.empty() && buffer_barriers.empty() && image_barriers.empty();
+    }
+
+    void clear() {
+        memory_barriers.clear();
+        buffer_barriers.clear();
+        image_barriers.clear();
+    }
+
+    void memory(VkPipelineStageFlags2 src_stage, VkPipelineStageFlags2 dst_stage,
+                VkAccessFlags2 src_access, VkAccessFlags2 dst_access) {
+        if(memory_barriers.empty()) {
+            memory_barriers.push(VkMemoryBarrier2{
+                .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            });
+        }
+        VkMemoryBarrier2& barrier = memory_barriers[0];
+        barrier.srcStageMask |= src_stage;
+        barrier.srcAccessMask |= src_access;
+        barrier.dstStageMask |= dst_stage;
+        barrier.dstAccessMask |= dst_access;
+    }
+
+    void buffer(VkBuffer buffer, VkPipelineStageFlags2 src_stage, VkPipelineStageFlags2 dst_stage,
+                VkAccessFlags2 src_access, VkAccessFlags2 dst_access, u64 offset = 0,
+                u64 size = VK_WHOLE_SIZE) {
+        for(auto& barrier : buffer_barriers) {
+            if(barrier.buffer == buffer && barrier.offset == offset && barrier.size == size) {
+                barrier.srcStageMask |= src_stage;
+                barrier.srcAccessMask |= src_access;
+                barrier.dstStageMask |= dst_stage;
+                barrier.dstAccessMask |= dst_access;
+                return;
+            }
+        }
+        buffer_barriers.push(VkBufferMemoryBarrier2{
+            .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER_2,
+            .srcStageMask = src_stage,
+            .srcAccessMask = src_access,
+            .dstStageMask = dst_stage,
+            .dstAccessMask = dst_access,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .buffer = buffer,
+            .offset = offset,
+            .size = size,
+        });
+    }
+
+    void image(VkImage image, VkImageSubresourceRange range, VkImageLayout src_layout,
+               VkImageLayout dst_layout, VkPipelineStageFlags2 src_stage,
+               VkPipelineStageFlags2 dst_stage, VkAccessFlags2 src_access,
+               VkAccessFlags2 dst_access) {
+        for(auto& barrier : image_barriers) {
+            if(barrier.image != image || !same(barrier.subresourceRange, range)) continue;
+            assert(barrier.oldLayout == src_layout && barrier.newLayout == dst_layout);
+            barrier.srcStageMask |= src_stage;
+            barrier.srcAccessMask |= src_access;
+            barrier.dstStageMask |= dst_stage;
+            barrier.dstAccessMask |= dst_access;
+            return;
+        }
+        image_barriers.push(VkImageMemoryBarrier2{
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = src_stage,
+            .srcAccessMask = src_access,
+            .dstStageMask = dst_stage,
+            .dstAccessMask = dst_access,
+            .oldLayout = src_layout,
+            .newLayout = dst_layout,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = image,
+            .subresourceRange = range,
+        });
+    }
+
+    // Records the barriers, if any, and clears them.
+    void flush(VkCommandBuffer cmds, VkDependencyFlags flags = 0) {
+        if(empty()) return;
+
+        VkDependencyInfo dependency = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .dependencyFlags = flags,
+            .memoryBarrierCount = static_cast<u32>(memory_barriers.length()),
+            .pMemoryBarriers = memory_barriers.data(),
+            .bufferMemoryBarrierCount = static_cast<u32>(buffer_barriers.length()),
+            .pBufferMemoryBarriers = buffer_barriers.data(),
+            .imageMemoryBarrierCount = static_cast<u32>(image_barriers.length()),
+            .pImageMemoryBarriers = image_barriers.data(),
+        };
+        vkCmdPipelineBarrier2(cmds, &dependency);
+
+        clear();
+    }
+
+private:
+    static bool same(const VkImageSubresourceRange& a, const VkImageSubresourceRange& b) {
+        return a.aspectMask == b.aspectMask && a.baseMipLevel == b.baseMipLevel &&
+               a.levelCount == b.levelCount && a.baseArrayLayer == b.baseArrayLayer &&
+               a.layerCount == b.layerCount;
+    }
+
+    Vec<VkMemoryBarrier2, A> memory_barriers;
+    Vec<VkBufferMemoryBarrier2, A> buffer_barriers;
+    Vec<VkImageMemoryBarrier2, A> image_barriers;
+};
+
+// Adds a barrier on the first mip level and array layer of an image aspect, which is all that
+// rvk's internal copies use.
+template<typename A>
+void image_barrier(Barriers<A>& barriers, VkImage image, VkImageAspectFlags aspect,
+                   VkImageLayout src_layout, VkImageLayout dst_layout, VkPipelineStageFlags2 stage,
+                   VkAccessFlags2 src_access, VkAccessFlags2 dst_access) {
+    barriers.image(image,
+                   VkImageSubresourceRange{
+                       .aspectMask = aspect,
+                       .baseMipLevel = 0,
+                       .levelCount = 1,
+                       .baseArrayLayer = 0,
+                       .layerCount = 1,
+                   },
+                   src_layout, dst_layout, stage, stage, src_access, dst_access);
+}
+
+} // namespace rvk::impl
@@ -0,0 +1,78 @@
+
+#include <stdlib.h>
+
+#include <rvk/rvk.h>
+
+using namespace rpp;
+
+// Streams data into a device buffer through rvk::upload and reports the throughput.
+// Usage: rvk-upload-benchmark [total MB = 1024] [upload KB = 1024]
+
+static VkSurfaceKHR create_headless_surface(VkInstance instance) {
+    VkHeadlessSurfaceCreateInfoEXT info = {
+        .sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT,
+    };
+    VkSurfaceKHR surface = null;
+    if(vkCreateHeadlessSurfaceEXT(instance, &info, null, &surface) != VK_SUCCESS) {
+        die("[rvk] Failed to create headless surface.");
+    }
+    return surface;
+}
+
+i32 main(i32 argc, char** argv) {
+
+    u64 total = Math::MB(argc > 1 ? strtoull(argv[1], null, 10) : 1024);
+    u64 piece = 1024 * (argc > 2 ? strtoull(argv[2], null, 10) : 1024);
+    if(total == 0 || piece == 0) {
+        die("[rvk] Usage: rvk-upload-benchmark [total MB] [upload KB]");
+    }
+
+    Array<String_View, 2> extensions{String_View{VK_KHR_SURFACE_EXTENSION_NAME},
+                                     String_View{VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME}};
+
+    if(!rvk::startup(rvk::Config{
+           .validation = false,
+           .swapchain_extensions = extensions.slice(),
+           .create_surface = create_headless_surface,
+           .defrag_budget = 0,
+           .gpu_scopes = 0,
+           .trace_events = 0,
+       })) {
+        die("[rvk] Failed to start up.");
+    }
+
+    {
+        // Each batch fills the destination buffer, then waits for its copies to complete.
+        u64 batch = Math::max(Math::MB(64), piece);
+
+        auto data = Vec<u8>::make(piece);
+        for(u64 i = 0; i < piece; i++) data[i] = static_cast<u8>(i);
+
+        auto dst = rvk::make_buffer(batch, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+        if(!dst.ok()) die("[rvk] Failed to allocate destination buffer of size %mb.",
+                               batch / Math::MB(1));
+
+        Profile::Time_Point start = Profile::timestamp();
+
+        for(u64 sent = 0; sent < total;) {
+            for(u64 offset = 0; offset < batch && sent < total; offset += piece) {
+                u64 size = Math::min(piece, Math::min(total - sent, batch - offset));
+                if(!rvk::upload(Slice<const u8>{data.data(), size}, *dst, offset).ok()) {
+                    die("[rvk] Failed to stage upload.");
+                }
+                sent += size;
+            }
+            static_cast<void>(rvk::submit_uploads());
+            rvk::wait_idle();
+        }
+
+        Profile::Time_Point end = Profile::timestamp();
+
+        f64 ms = Profile::ms(end - start);
+        info("[rvk] Uploaded %mb in %kb pieces in %ms: % GB/s.", total / Math::MB(1),
+             piece / 1024, ms, static_cast<f64>(total) / Math::GB(1) / (ms / 1000.0));
+    }
+
+    rvk::shutdown();
+    return 0;
+}
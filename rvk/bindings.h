@@ -211,6 +211,11 @@ struct Buffer_Uniform {
         info.offset = 0;
         info.range = VK_WHOLE_SIZE;
     }
+    explicit Buffer_Uniform(Buffer_Slice& slice) {
+        info.buffer = slice;
+        info.offset = slice.offset();
+        info.range = slice.length();
+    }
 
     VkDescriptorBufferInfo info;
 
@@ -242,6 +247,11 @@ struct Buffer_Storage {
         info.offset = 0;
         info.range = VK_WHOLE_SIZE;
     }
+    explicit Buffer_Storage(Buffer_Slice& slice) {
+        info.buffer = slice;
+        info.offset = slice.offset();
+        info.range = slice.length();
+    }
 
     VkDescriptorBufferInfo info;
 
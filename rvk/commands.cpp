@@ -4,9 +4,12 @@
 #include "commands.h"
 #include "device.h"
 #include "memory.h"
+#include "trace.h"
 
 #ifdef RPP_OS_LINUX
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
 #endif
 
 namespace rvk::impl {
@@ -14,27 +17,19 @@ namespace rvk::impl {
 using namespace rpp;
 
 Fence::Fence(Arc<Device, Alloc> D) : device(move(D)) {
+    fence = device->acquire_fence();
+}
 
-    VkExportFenceCreateInfo export_info = {
-        .sType = VK_STRUCTURE_TYPE_EXPORT_FENCE_CREATE_INFO,
-#ifdef RPP_OS_WINDOWS
-        .handleTypes = VK_EXTERNAL_FENCE_HANDLE_TYPE_OPAQUE_WIN32_BIT,
-#else
-        .handleTypes = VK_EXTERNAL_FENCE_HANDLE_TYPE_OPAQUE_FD_BIT,
-#endif
-    };
-
-    VkFenceCreateInfo info = {
-        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-        .pNext = &export_info,
-        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
-    };
-
-    RVK_CHECK(vkCreateFence(*device, &info, null, &fence));
+Fence::Fence(Arc<Device, Alloc> D, Arc<Timeline_Waiter, Alloc> W)
+    : device(move(D)), waiter(move(W)) {
+    fence = device->acquire_fence();
 }
 
 Fence::~Fence() {
-    if(fence) vkDestroyFence(*device, fence, null);
+    if(fence) {
+        if(waiter.ok()) waiter->forget(fence);
+        device->release_fence(fence);
+    }
     fence = null;
 }
 
@@ -46,6 +41,7 @@ Fence& Fence::operator=(Fence&& src) {
     assert(this != &src);
     this->~Fence();
     device = move(src.device);
+    waiter = move(src.waiter);
     fence = src.fence;
     src.fence = null;
     return *this;
@@ -53,16 +49,18 @@ Fence& Fence::operator=(Fence&& src) {
 
 void Fence::wait() const {
     assert(fence);
+    Event_Scope scope{"Wait for fence"_v};
     RVK_CHECK(vkWaitForFences(*device, 1, &fence, VK_TRUE, UINT64_MAX));
 }
 
 void Fence::reset() {
     assert(fence);
-    RVK_CHECK(vkResetFences(*device, 1, &fence));
+    device->reset_fence(fence);
 }
 
 Async::Event Fence::event() const {
     assert(fence);
+    if(waiter.ok()) return waiter->event(fence);
 #ifdef RPP_OS_WINDOWS
     HANDLE handle = null;
     VkFenceGetWin32HandleInfoKHR info = {
@@ -93,15 +91,12 @@ bool Fence::ready() const {
     RPP_UNREACHABLE;
 }
 
-Semaphore::Semaphore(Arc<Device, Alloc> D) : device(move(D)) {
-    VkSemaphoreCreateInfo info = {
-        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
-    };
-    RVK_CHECK(vkCreateSemaphore(*device, &info, null, &semaphore));
+Semaphore::Semaphore(Arc<Device, Alloc> D, bool recycle) : device(move(D)), recycle(recycle) {
+    semaphore = device->acquire_semaphore();
 }
 
 Semaphore::~Semaphore() {
-    if(semaphore) vkDestroySemaphore(*device, semaphore, null);
+    if(semaphore) device->release_semaphore(semaphore, recycle);
     semaphore = null;
 }
 
@@ -114,16 +109,364 @@ Semaphore& Semaphore::operator=(Semaphore&& src) {
     this->~Semaphore();
     device = move(src.device);
     semaphore = src.semaphore;
+    recycle = src.recycle;
+    src.semaphore = null;
+    return *this;
+}
+
+Sem_Ref::Sem_Ref(Semaphore& sem, VkPipelineStageFlags2 stage)
+    : sem(sem), stage(stage), binary(true) {
+}
+
+Sem_Ref::Sem_Ref(Timeline& timeline, u64 value, VkPipelineStageFlags2 stage)
+    : sem(timeline), value(value), stage(stage) {
+}
+
+static VkSemaphore make_timeline(Device& device, u64 value) {
+
+    VkSemaphoreTypeCreateInfo type_info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = value,
+    };
+
+    VkSemaphoreCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &type_info,
+    };
+
+    VkSemaphore semaphore = null;
+    RVK_CHECK(vkCreateSemaphore(device, &info, null, &semaphore));
+    return semaphore;
+}
+
+Timeline::Timeline(Arc<Device, Alloc> D, Arc<Timeline_Waiter, Alloc> W, u64 value)
+    : device(move(D)), waiter(move(W)) {
+    semaphore = make_timeline(*device, value);
+}
+
+Timeline::~Timeline() {
+    if(semaphore) {
+        waiter->forget(semaphore);
+        vkDestroySemaphore(*device, semaphore, null);
+    }
+    semaphore = null;
+}
+
+Timeline::Timeline(Timeline&& src) {
+    *this = move(src);
+}
+
+Timeline& Timeline::operator=(Timeline&& src) {
+    assert(this != &src);
+    this->~Timeline();
+    device = move(src.device);
+    waiter = move(src.waiter);
+    semaphore = src.semaphore;
     src.semaphore = null;
     return *this;
 }
 
-Commands::Commands(Arc<Command_Pool, Alloc> pool, Queue_Family family, VkCommandBuffer buffer)
-    : pool(move(pool)), buffer(buffer), family_(family) {
+u64 Timeline::value() const {
+    assert(semaphore);
+    u64 value = 0;
+    RVK_CHECK(vkGetSemaphoreCounterValue(*device, semaphore, &value));
+    return value;
+}
+
+bool Timeline::ready(u64 value) const {
+    return this->value() >= value;
+}
+
+void Timeline::wait(u64 value) const {
+    assert(semaphore);
+    Event_Scope scope{"Wait for timeline"_v};
+    VkSemaphoreWaitInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &semaphore,
+        .pValues = &value,
+    };
+    RVK_CHECK(vkWaitSemaphores(*device, &info, UINT64_MAX));
+}
+
+void Timeline::signal(u64 value) {
+    assert(semaphore);
+    VkSemaphoreSignalInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO,
+        .semaphore = semaphore,
+        .value = value,
+    };
+    RVK_CHECK(vkSignalSemaphore(*device, &info));
+}
+
+Async::Event Timeline::event(u64 value) const {
+    assert(semaphore);
+    return waiter->event(semaphore, value);
+}
+
+Timeline_Waiter::Timeline_Waiter(Arc<Device, Alloc> D) : device(move(D)) {
+    wake_semaphore = make_timeline(*device, 0);
+    thread = Thread::spawn(Run{this});
+}
+
+Timeline_Waiter::~Timeline_Waiter() {
+    {
+        Thread::Lock lock{mutex};
+        stop = true;
+        wake();
+    }
+    thread->block();
+    for(auto& entry : entries) {
+        notify(entry);
+    }
+    entries.clear();
+    vkDestroySemaphore(*device, wake_semaphore, null);
+}
+
+Async::Event Timeline_Waiter::event(VkSemaphore semaphore, u64 value) {
+    return add(Entry{.semaphore = semaphore, .value = value});
+}
+
+Async::Event Timeline_Waiter::event(VkFence fence) {
+    return add(Entry{.fence = fence});
+}
+
+Async::Event Timeline_Waiter::add(Entry entry) {
+    Thread::Lock lock{mutex};
+#ifdef RPP_OS_WINDOWS
+    HANDLE handle = CreateEventW(null, TRUE, FALSE, null);
+    DuplicateHandle(GetCurrentProcess(), handle, GetCurrentProcess(), &entry.handle, 0, FALSE,
+                    DUPLICATE_SAME_ACCESS);
+    entries.push(move(entry));
+    wake();
+    return Async::Event::of_sys(handle);
+#else
+    i32 fd = eventfd(0, EFD_NONBLOCK);
+    entry.fd = dup(fd);
+    entries.push(move(entry));
+    wake();
+    return Async::Event::of_sys(fd, EPOLLIN);
+#endif
+}
+
+void Timeline_Waiter::forget(VkSemaphore semaphore) {
+    Thread::Lock lock{mutex};
+
+    bool found = false;
+    Vec<Entry, Alloc> kept;
+    for(auto& entry : entries) {
+        if(!entry.fence && entry.semaphore == semaphore) {
+            notify(entry);
+            found = true;
+        } else {
+            kept.push(move(entry));
+        }
+    }
+    if(!found) return;
+    entries = move(kept);
+
+    // The thread may be waiting on the semaphore, so wait until it has taken a new snapshot.
+    u64 seen = generation;
+    wake();
+    while(generation == seen && !stop) {
+        cond.wait(mutex);
+    }
+}
+
+void Timeline_Waiter::forget(VkFence fence) {
+    // The thread only queries fences with the mutex held, so it is done with this one once
+    // its entries are removed.
+    Thread::Lock lock{mutex};
+    Vec<Entry, Alloc> kept;
+    for(auto& entry : entries) {
+        if(entry.fence == fence) {
+            notify(entry);
+        } else {
+            kept.push(move(entry));
+        }
+    }
+    entries = move(kept);
+}
+
+void Timeline_Waiter::wake() {
+    VkSemaphoreSignalInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO,
+        .semaphore = wake_semaphore,
+        .value = ++wake_value,
+    };
+    RVK_CHECK(vkSignalSemaphore(*device, &info));
+}
+
+void Timeline_Waiter::notify(Entry& entry) {
+#ifdef RPP_OS_WINDOWS
+    SetEvent(entry.handle);
+    CloseHandle(entry.handle);
+    entry.handle = null;
+#else
+    u64 one = 1;
+    [[maybe_unused]] auto written = write(entry.fd, &one, sizeof(one));
+    close(entry.fd);
+    entry.fd = -1;
+#endif
+}
+
+void Timeline_Waiter::run() {
+
+    Vec<VkSemaphore, Alloc> semaphores;
+    Vec<u64, Alloc> values;
+
+    for(;;) {
+        {
+            Thread::Lock lock{mutex};
+            if(stop) return;
+
+            // Fences wait on the queue timeline value of their submission. Fences that are not
+            // submitted yet wait for the next fenced submission, so the submissions are counted
+            // before the fences are checked.
+            auto [submissions, submitted] = device->fence_submissions();
+            bool unsubmitted = false;
+
+            // Every completed entry is notified in one pass.
+            Vec<Entry, Alloc> waiting;
+            for(auto& entry : entries) {
+                bool done = false;
+                if(entry.fence) {
+                    auto wait = device->fence_wait(entry.fence);
+                    done = wait.signaled;
+                    entry.semaphore = wait.timeline;
+                    entry.value = wait.value;
+                    unsubmitted = unsubmitted || (!done && !wait.timeline);
+                } else {
+                    u64 value = 0;
+                    RVK_CHECK(vkGetSemaphoreCounterValue(*device, entry.semaphore, &value));
+                    done = value >= entry.value;
+                }
+                if(done) {
+                    notify(entry);
+                } else {
+                    waiting.push(move(entry));
+                }
+            }
+            entries = move(waiting);
+
+            semaphores.clear();
+            values.clear();
+            semaphores.push(wake_semaphore);
+            values.push(wake_value + 1);
+            for(auto& entry : entries) {
+                if(!entry.semaphore) continue;
+                semaphores.push(entry.semaphore);
+                values.push(entry.value);
+            }
+            if(unsubmitted) {
+                semaphores.push(submissions);
+                values.push(submitted + 1);
+            }
+
+            generation++;
+            cond.broadcast();
+        }
+
+        VkSemaphoreWaitInfo info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+            .flags = VK_SEMAPHORE_WAIT_ANY_BIT,
+            .semaphoreCount = static_cast<u32>(semaphores.length()),
+            .pSemaphores = semaphores.data(),
+            .pValues = values.data(),
+        };
+        RVK_CHECK(vkWaitSemaphores(*device, &info, UINT64_MAX));
+    }
+}
+
+static VkSemaphoreSubmitInfo submit_info(const Sem_Ref& sem) {
+    // Values are ignored for binary semaphores.
+    return VkSemaphoreSubmitInfo{
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = sem.sem,
+        .value = sem.value,
+        .stageMask = sem.stage,
+    };
+}
+
+void Submit_Batch::add(Commands& buffer, u32 index) {
+    add(buffer, index, {}, {});
+}
+
+void Submit_Batch::add(Commands& buffer, u32 index, Slice<const Sem_Ref> wait,
+                       Slice<const Sem_Ref> signal) {
+
+    buffer.submitted(index);
+
+    cmds.push(VkCommandBufferSubmitInfo{
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
+        .commandBuffer = buffer,
+    });
+
+    // Extend the previous submit info if nothing has to happen between the two.
+    if(!entries.empty() && wait.empty()) {
+        Entry& last = entries.back();
+        if(last.family == buffer.family() && last.index == index && last.signal_count == 0) {
+            last.cmds_count++;
+            last.signal_offset = static_cast<u32>(signals.length());
+            last.signal_count = static_cast<u32>(signal.length());
+            for(auto& sem : signal) signals.push(submit_info(sem));
+            return;
+        }
+    }
+
+    Entry entry = {
+        .family = buffer.family(),
+        .index = index,
+        .wait_offset = static_cast<u32>(waits.length()),
+        .wait_count = static_cast<u32>(wait.length()),
+        .cmds_offset = static_cast<u32>(cmds.length() - 1),
+        .cmds_count = 1,
+        .signal_offset = static_cast<u32>(signals.length()),
+        .signal_count = static_cast<u32>(signal.length()),
+    };
+    for(auto& sem : wait) {
+        entry.binary_waits = entry.binary_waits || sem.binary;
+        waits.push(submit_info(sem));
+    }
+    for(auto& sem : signal) signals.push(submit_info(sem));
+    entries.push(entry);
+}
+
+void Submit_Batch::append(const Submit_Batch& src, const Entry& entry) {
+    Entry copy = entry;
+    copy.wait_offset = static_cast<u32>(waits.length());
+    copy.cmds_offset = static_cast<u32>(cmds.length());
+    copy.signal_offset = static_cast<u32>(signals.length());
+    for(u32 i = 0; i < entry.wait_count; i++) waits.push(src.waits[entry.wait_offset + i]);
+    for(u32 i = 0; i < entry.cmds_count; i++) cmds.push(src.cmds[entry.cmds_offset + i]);
+    for(u32 i = 0; i < entry.signal_count; i++) {
+        signals.push(src.signals[entry.signal_offset + i]);
+    }
+    entries.push(copy);
+}
+
+bool Submit_Batch::binary_waits() const {
+    for(auto& entry : entries) {
+        if(entry.binary_waits) return true;
+    }
+    return false;
+}
+
+void Submit_Batch::clear() {
+    entries.clear();
+    waits.clear();
+    cmds.clear();
+    signals.clear();
+}
+
+Commands::Commands(Arc<Command_Pool, Alloc> pool, Queue_Family family, VkCommandBuffer buffer,
+                   bool secondary)
+    : pool(move(pool)), buffer(buffer), family_(family), secondary_(secondary) {
 }
 
 Commands::~Commands() {
-    if(buffer) pool->release(buffer);
+    if(buffer) pool->release(buffer, secondary_, recording);
     buffer = null;
 }
 
@@ -138,7 +481,11 @@ Commands& Commands::operator=(Commands&& src) {
     Thread::Lock l1(src.mutex);
     pool = move(src.pool);
     transient_buffers = move(src.transient_buffers);
+    secondaries = move(src.secondaries);
+    queue_tags = move(src.queue_tags);
     family_ = src.family_;
+    secondary_ = src.secondary_;
+    recording = src.recording;
     buffer = src.buffer;
     src.buffer = null;
     return *this;
@@ -150,31 +497,80 @@ void Commands::attach(Buffer buf) {
     transient_buffers.push(move(buf));
 }
 
-void Commands::reset() {
+void Commands::execute(Vec<Commands, Alloc> buffers) {
     assert(buffer);
+    if(buffers.empty()) return;
+
+    Region(R) {
+        Vec<VkCommandBuffer, Mregion<R>> handles(buffers.length());
+        for(auto& secondary : buffers) {
+            assert(secondary.secondary_);
+            handles.push(secondary.buffer);
+        }
+        vkCmdExecuteCommands(buffer, static_cast<u32>(handles.length()), handles.data());
+    }
+
+    Thread::Lock lock(mutex);
+    for(auto& secondary : buffers) {
+        for(u32* tag : secondary.queue_tags) queue_tags.push(move(tag));
+        secondary.queue_tags.clear();
+        secondaries.push(move(secondary));
+    }
+}
 
-    RVK_CHECK(vkResetCommandBuffer(buffer, 0));
+void Commands::tag_queue(u32* tag) {
+    Thread::Lock lock(mutex);
+    queue_tags.push(move(tag));
+}
+
+void Commands::submitted(u32 index) {
+    Thread::Lock lock(mutex);
+    for(u32* tag : queue_tags) *tag = index;
+    queue_tags.clear();
+}
+
+void Commands::reset() {
+    assert(buffer);
+    // Secondary buffers are begun with their inheritance info, so they're not reused in place.
+    // Frame-scoped buffers can only be reset with their whole pool.
+    assert(!secondary_ && !pool->frame_scoped);
 
     {
         Thread::Lock lock(mutex);
         transient_buffers.clear();
+        secondaries.clear();
+        queue_tags.clear();
     }
 
+    // Beginning implicitly resets an ended buffer, but not one that is still recording.
+    if(recording) RVK_CHECK(vkResetCommandBuffer(buffer, 0));
+
     VkCommandBufferBeginInfo begin_info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
         .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
     };
 
     RVK_CHECK(vkBeginCommandBuffer(buffer, &begin_info));
+    recording = true;
 }
 
 void Commands::end() {
     assert(buffer);
     RVK_CHECK(vkEndCommandBuffer(buffer));
+    recording = false;
 }
 
-Command_Pool::Command_Pool(Arc<Device, Alloc> device, Queue_Family family, VkCommandPool pool)
-    : device(move(device)), command_pool(pool), family(family) {
+Command_Pool::Command_Pool(Arc<Device, Alloc> D, Queue_Family family, bool frame_scoped)
+    : device(move(D)), family(family), frame_scoped(frame_scoped) {
+
+    VkCommandPoolCreateInfo create_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+        .flags = frame_scoped ? VK_COMMAND_POOL_CREATE_TRANSIENT_BIT
+                              : VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .queueFamilyIndex = device->queue_index(family),
+    };
+
+    RVK_CHECK(vkCreateCommandPool(*device, &create_info, null, &command_pool));
 }
 
 Command_Pool::~Command_Pool() {
@@ -187,12 +583,15 @@ Command_Pool::~Command_Pool() {
 
 Commands Command_Pool::make() {
     Thread::Lock lock(mutex);
+    if(!frame_scoped) reset_unended();
 
+    // Beginning an ended buffer implicitly resets it, so recycled buffers are not reset here.
     VkCommandBuffer buffer = null;
-    if(!free_list.empty()) {
+    if(frame_scoped && used < free_list.length()) {
+        buffer = free_list[used++];
+    } else if(!frame_scoped && !free_list.empty()) {
         buffer = free_list.back();
         free_list.pop();
-        vkResetCommandBuffer(buffer, 0);
     } else {
         VkCommandBufferAllocateInfo info = {
             .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
@@ -201,6 +600,10 @@ Commands Command_Pool::make() {
             .commandBufferCount = 1,
         };
         RVK_CHECK(vkAllocateCommandBuffers(*device, &info, &buffer));
+        if(frame_scoped) {
+            free_list.push(buffer);
+            used++;
+        }
     }
 
     VkCommandBufferBeginInfo begin_info = {
@@ -209,16 +612,93 @@ Commands Command_Pool::make() {
     };
     RVK_CHECK(vkBeginCommandBuffer(buffer, &begin_info));
 
-    return Commands{Arc<Command_Pool, Alloc>::from_this(this), family, buffer};
+    return Commands{Arc<Command_Pool, Alloc>::from_this(this), family, buffer, false};
+}
+
+Commands Command_Pool::make_secondary(const Rendering_Formats& formats) {
+    assert(!frame_scoped);
+    Thread::Lock lock(mutex);
+    reset_unended();
+
+    VkCommandBuffer buffer = null;
+    if(!free_secondaries.empty()) {
+        buffer = free_secondaries.back();
+        free_secondaries.pop();
+    } else {
+        VkCommandBufferAllocateInfo info = {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = command_pool,
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount = 1,
+        };
+        RVK_CHECK(vkAllocateCommandBuffers(*device, &info, &buffer));
+    }
+
+    VkCommandBufferInheritanceRenderingInfo rendering_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO,
+        .viewMask = formats.view_mask,
+        .colorAttachmentCount = static_cast<u32>(formats.color.length()),
+        .pColorAttachmentFormats = formats.color.data(),
+        .depthAttachmentFormat = formats.depth,
+        .stencilAttachmentFormat = formats.stencil,
+        .rasterizationSamples = formats.samples,
+    };
+
+    VkCommandBufferInheritanceInfo inheritance_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .pNext = &rendering_info,
+    };
+
+    VkCommandBufferBeginInfo begin_info = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                 VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inheritance_info,
+    };
+    RVK_CHECK(vkBeginCommandBuffer(buffer, &begin_info));
+
+    return Commands{Arc<Command_Pool, Alloc>::from_this(this), family, buffer, true};
+}
+
+void Command_Pool::release(VkCommandBuffer buffer, bool secondary, bool recording) {
+    if(frame_scoped) return;
+    Thread::Lock lock(mutex);
+    if(recording) {
+        (secondary ? unended_secondaries : unended).push(buffer);
+    } else if(secondary) {
+        free_secondaries.push(buffer);
+    } else {
+        free_list.push(buffer);
+    }
+}
+
+void Command_Pool::reset_unended() {
+    // Called with the mutex held, on the thread that owns the pool.
+    for(VkCommandBuffer buffer : unended) {
+        RVK_CHECK(vkResetCommandBuffer(buffer, 0));
+        free_list.push(buffer);
+    }
+    for(VkCommandBuffer buffer : unended_secondaries) {
+        RVK_CHECK(vkResetCommandBuffer(buffer, 0));
+        free_secondaries.push(buffer);
+    }
+    unended.clear();
+    unended_secondaries.clear();
 }
 
-void Command_Pool::release(VkCommandBuffer buffer) {
+void Command_Pool::reset() {
+    assert(frame_scoped);
     Thread::Lock lock(mutex);
-    free_list.push(buffer);
+    RVK_CHECK(vkResetCommandPool(*device, command_pool, 0));
+    used = 0;
 }
 
 template<Queue_Family F>
-Command_Pool_Manager<F>::Command_Pool_Manager(Arc<Device, Alloc> device) : device(move(device)) {
+Command_Pool_Manager<F>::Command_Pool_Manager(Arc<Device, Alloc> device, u32 frames_in_flight)
+    : device(move(device)), frames_in_flight(frames_in_flight) {
+    for(u32 i = 0; i < frames_in_flight; i++) {
+        frame_pools.emplace();
+    }
 }
 
 template<Queue_Family F>
@@ -233,6 +713,11 @@ Command_Pool_Manager<F>::~Command_Pool_Manager() {
         active_threads.clear();
     }
 
+    for(auto& pools : frame_pools) {
+        pools.clear();
+    }
+    free_frame_pools.clear();
+
     if(!free_list.empty()) {
         free_list.clear();
         info("[rvk] Destroyed command pools for family %.", F);
@@ -253,16 +738,7 @@ void Command_Pool_Manager<F>::begin_thread() {
 
         Profile::Time_Point start = Profile::timestamp();
 
-        VkCommandPoolCreateInfo create_info = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-            .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
-            .queueFamilyIndex = device->queue_index(F),
-        };
-
-        VkCommandPool pool = null;
-        RVK_CHECK(vkCreateCommandPool(*device, &create_info, null, &pool));
-
-        this_thread.pool = Arc<Command_Pool, Alloc>::make(device.dup(), F, pool);
+        this_thread.pool = Arc<Command_Pool, Alloc>::make(device.dup(), F, false);
 
         Profile::Time_Point end = Profile::timestamp();
         info("[rvk] Allocated new % command pool for thread % in %ms.", F, id,
@@ -279,6 +755,28 @@ void Command_Pool_Manager<F>::begin_thread() {
     active_threads.insert(id, {});
 }
 
+template<Queue_Family F>
+void Command_Pool_Manager<F>::begin_frame_thread() {
+
+    if(!this_thread.pool.ok()) begin_thread();
+    assert(this_thread.frame_pools.empty());
+
+    Thread::Lock lock(mutex);
+
+    if(free_frame_pools.empty()) {
+        for(u32 i = 0; i < frames_in_flight; i++) {
+            auto pool = Arc<Command_Pool, Alloc>::make(device.dup(), F, true);
+            frame_pools[i].push(pool.dup());
+            this_thread.frame_pools.push(move(pool));
+        }
+        info("[rvk] Allocated % frame command pools for % in thread %.", frames_in_flight, F,
+             Thread::this_id());
+    } else {
+        this_thread.frame_pools = move(free_frame_pools.back());
+        free_frame_pools.pop();
+    }
+}
+
 template<Queue_Family F>
 void Command_Pool_Manager<F>::end_thread() {
 
@@ -292,9 +790,13 @@ void Command_Pool_Manager<F>::end_thread() {
     assert(active_threads.contains(id));
 
     free_list.push(move(this_thread.pool));
+    if(!this_thread.frame_pools.empty()) {
+        free_frame_pools.push(move(this_thread.frame_pools));
+    }
     active_threads.erase(id);
 
     this_thread.pool = {};
+    this_thread.frame_pools = {};
     this_thread.pool_manager = {};
 }
 
@@ -304,6 +806,26 @@ Commands Command_Pool_Manager<F>::make() {
     return this_thread.pool->make();
 }
 
+template<Queue_Family F>
+Commands Command_Pool_Manager<F>::make_secondary(const Rendering_Formats& formats) {
+    if(!this_thread.pool.ok()) begin_thread();
+    return this_thread.pool->make_secondary(formats);
+}
+
+template<Queue_Family F>
+Commands Command_Pool_Manager<F>::make_frame(u32 frame) {
+    if(this_thread.frame_pools.empty()) begin_frame_thread();
+    return this_thread.frame_pools[frame]->make();
+}
+
+template<Queue_Family F>
+void Command_Pool_Manager<F>::reset_frame(u32 frame) {
+    Thread::Lock lock(mutex);
+    for(auto& pool : frame_pools[frame]) {
+        pool->reset();
+    }
+}
+
 template struct Command_Pool_Manager<Queue_Family::graphics>;
 template struct Command_Pool_Manager<Queue_Family::compute>;
 template struct Command_Pool_Manager<Queue_Family::transfer>;
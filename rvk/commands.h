@@ -31,21 +31,29 @@ struct Fence {
     void reset();
     void wait() const;
     bool ready() const;
+    // Served by the Timeline_Waiter if the fence has one, and otherwise by an exported handle.
+    // The fence must outlive the event.
     Async::Event event() const;
 
 private:
     explicit Fence(Arc<Device, Alloc> device);
+    explicit Fence(Arc<Device, Alloc> device, Arc<Timeline_Waiter, Alloc> waiter);
     friend struct Vk;
+    friend struct Defragmenter;
+    friend struct Uploader;
 
     Arc<Device, Alloc> device;
+    Arc<Timeline_Waiter, Alloc> waiter;
     VkFence fence = null;
 };
 
 struct Sem_Ref {
-    explicit Sem_Ref(Semaphore& sem, VkPipelineStageFlags2 stage) : sem(sem), stage(stage) {
-    }
-    Ref<Semaphore> sem;
+    explicit Sem_Ref(Semaphore& sem, VkPipelineStageFlags2 stage);
+    explicit Sem_Ref(Timeline& timeline, u64 value, VkPipelineStageFlags2 stage);
+    VkSemaphore sem = null;
+    u64 value = 0;
     VkPipelineStageFlags2 stage;
+    bool binary = false;
 };
 
 struct Semaphore {
@@ -63,13 +71,116 @@ struct Semaphore {
     }
 
 private:
-    explicit Semaphore(Arc<Device, Alloc> device);
+    // A recycled semaphore is reused once released, so it must have no signal left to wait
+    // on by then. Semaphores that may be left signaled are not recycled.
+    explicit Semaphore(Arc<Device, Alloc> device, bool recycle = false);
+    friend struct Vk;
+    friend struct Uploader;
+
+    Arc<Device, Alloc> device;
+    VkSemaphore semaphore = null;
+    bool recycle = false;
+};
+
+struct Timeline {
+
+    Timeline() = default;
+    ~Timeline();
+
+    Timeline(const Timeline&) = delete;
+    Timeline& operator=(const Timeline&) = delete;
+    Timeline(Timeline&&);
+    Timeline& operator=(Timeline&&);
+
+    operator VkSemaphore() const {
+        return semaphore;
+    }
+
+    u64 value() const;
+    bool ready(u64 value) const;
+    void wait(u64 value) const;
+    void signal(u64 value);
+    Async::Event event(u64 value) const;
+
+private:
+    explicit Timeline(Arc<Device, Alloc> device, Arc<Timeline_Waiter, Alloc> waiter, u64 value);
     friend struct Vk;
 
     Arc<Device, Alloc> device;
+    Arc<Timeline_Waiter, Alloc> waiter;
     VkSemaphore semaphore = null;
 };
 
+// Timeline semaphores can't be exported as pollable handles, so Timeline::event is served by
+// a thread that waits for any pending value. The thread is woken through a host-signaled
+// timeline whenever a value is added or a semaphore is forgotten. It also serves Fence::event,
+// so that pending fences don't each hold an exported handle, and notifies every completed
+// entry in one pass.
+struct Timeline_Waiter {
+
+    ~Timeline_Waiter();
+
+    Timeline_Waiter(const Timeline_Waiter&) = delete;
+    Timeline_Waiter& operator=(const Timeline_Waiter&) = delete;
+    Timeline_Waiter(Timeline_Waiter&&) = delete;
+    Timeline_Waiter& operator=(Timeline_Waiter&&) = delete;
+
+    Async::Event event(VkSemaphore semaphore, u64 value);
+    Async::Event event(VkFence fence);
+
+    // Signals pending events of the semaphore and stops waiting on it before it is destroyed.
+    void forget(VkSemaphore semaphore);
+    // Signals pending events of the fence before it is destroyed or recycled.
+    void forget(VkFence fence);
+
+private:
+    explicit Timeline_Waiter(Arc<Device, Alloc> device);
+    friend struct Arc<Timeline_Waiter, Alloc>;
+
+    struct Entry {
+        VkSemaphore semaphore = null;
+        u64 value = 0;
+        VkFence fence = null;
+#ifdef RPP_OS_WINDOWS
+        HANDLE handle = null;
+#else
+        i32 fd = -1;
+#endif
+    };
+
+    struct Run {
+        Timeline_Waiter* waiter;
+        void operator()() {
+            waiter->run();
+        }
+    };
+
+    Async::Event add(Entry entry);
+    void run();
+    void wake();
+    static void notify(Entry& entry);
+
+    Arc<Device, Alloc> device;
+    VkSemaphore wake_semaphore = null;
+    u64 wake_value = 0;
+    u64 generation = 0;
+    bool stop = false;
+
+    Thread::Mutex mutex;
+    Thread::Cond cond;
+    Vec<Entry, Alloc> entries;
+    decltype(Thread::spawn(Run{})) thread;
+};
+
+// Attachment formats of a dynamic rendering scope, inherited by secondary command buffers.
+struct Rendering_Formats {
+    Slice<const VkFormat> color;
+    VkFormat depth = VK_FORMAT_UNDEFINED;
+    VkFormat stencil = VK_FORMAT_UNDEFINED;
+    VkSampleCountFlagBits samples = VK_SAMPLE_COUNT_1_BIT;
+    u32 view_mask = 0;
+};
+
 struct Commands {
 
     Commands() = default;
@@ -87,21 +198,91 @@ struct Commands {
         return family_;
     }
 
+    bool secondary() const {
+        return secondary_;
+    }
+
     void reset();
     void end();
     void attach(Buffer buf);
 
+    // Executes ended secondary command buffers in order. They are kept alive with this buffer.
+    // Inside a rendering scope, it must have been begun with
+    // VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT.
+    void execute(Vec<Commands, Alloc> secondaries);
+
 private:
-    explicit Commands(Arc<Command_Pool, Alloc> pool, Queue_Family family, VkCommandBuffer buffer);
+    explicit Commands(Arc<Command_Pool, Alloc> pool, Queue_Family family, VkCommandBuffer buffer,
+                      bool secondary);
+
+    // Profiler scopes recorded into this buffer or its secondaries. Each is given the index of
+    // the queue the buffer is submitted to.
+    void tag_queue(u32* tag);
+    void submitted(u32 index);
 
     Arc<Command_Pool, Alloc> pool;
     Vec<Buffer, Alloc> transient_buffers;
+    Vec<Commands, Alloc> secondaries;
+    Vec<u32*, Alloc> queue_tags;
 
     Thread::Mutex mutex;
     VkCommandBuffer buffer = null;
     Queue_Family family_ = Queue_Family::graphics;
+    bool secondary_ = false;
+    // Begun and not yet ended. Beginning only resets buffers that are not recording.
+    bool recording = true;
 
     friend struct Command_Pool;
+    friend struct Submit_Batch;
+    friend struct Device;
+    friend struct Gpu_Profiler;
+};
+
+// Collects command buffers and semaphores for many submissions, which Device::submit flushes
+// with one vkQueueSubmit2 call per queue. Consecutive commands for the same queue share a
+// submit info unless a semaphore separates them. Queues are flushed in order of first use, so
+// a binary semaphore waited on in the batch must be signaled on a queue that was used earlier;
+// timeline semaphores have no such restriction. The commands must outlive the submission.
+struct Submit_Batch {
+
+    Submit_Batch() = default;
+    ~Submit_Batch() = default;
+
+    Submit_Batch(const Submit_Batch&) = delete;
+    Submit_Batch& operator=(const Submit_Batch&) = delete;
+    Submit_Batch(Submit_Batch&&) = default;
+    Submit_Batch& operator=(Submit_Batch&&) = default;
+
+    void add(Commands& cmds, u32 index = 0);
+    void add(Commands& cmds, u32 index, Slice<const Sem_Ref> wait, Slice<const Sem_Ref> signal);
+
+    bool empty() const {
+        return entries.empty();
+    }
+    void clear();
+
+private:
+    struct Entry {
+        Queue_Family family = Queue_Family::graphics;
+        u32 index = 0;
+        u32 wait_offset = 0;
+        u32 wait_count = 0;
+        u32 cmds_offset = 0;
+        u32 cmds_count = 0;
+        u32 signal_offset = 0;
+        u32 signal_count = 0;
+        bool binary_waits = false;
+    };
+
+    Vec<Entry, Alloc> entries;
+    Vec<VkSemaphoreSubmitInfo, Alloc> waits;
+    Vec<VkCommandBufferSubmitInfo, Alloc> cmds;
+    Vec<VkSemaphoreSubmitInfo, Alloc> signals;
+
+    void append(const Submit_Batch& src, const Entry& entry);
+    bool binary_waits() const;
+
+    friend struct Device;
 };
 
 struct Command_Pool {
@@ -114,18 +295,30 @@ struct Command_Pool {
     Command_Pool& operator=(Command_Pool&& src) = delete;
 
 private:
-    explicit Command_Pool(Arc<Device, Alloc> device, Queue_Family family, VkCommandPool pool);
+    explicit Command_Pool(Arc<Device, Alloc> device, Queue_Family family, bool frame_scoped);
     friend struct Arc<Command_Pool, Alloc>;
 
     Commands make();
-    void release(VkCommandBuffer commands);
+    Commands make_secondary(const Rendering_Formats& formats);
+    void release(VkCommandBuffer commands, bool secondary, bool recording);
+    void reset_unended();
+    void reset();
 
     Arc<Device, Alloc> device;
     VkCommandPool command_pool = null;
     Vec<VkCommandBuffer, Alloc> free_list;
+    Vec<VkCommandBuffer, Alloc> free_secondaries;
+    // Buffers released while recording. They are reset on the pool's thread before reuse.
+    Vec<VkCommandBuffer, Alloc> unended;
+    Vec<VkCommandBuffer, Alloc> unended_secondaries;
     Queue_Family family = Queue_Family::graphics;
     Thread::Mutex mutex;
 
+    // Frame-scoped pools never release buffers individually. Their buffers are handed out
+    // in order and all become available again when the whole pool is reset.
+    bool frame_scoped = false;
+    u64 used = 0;
+
     template<Queue_Family F>
     friend struct Command_Pool_Manager;
     friend struct Commands;
@@ -152,11 +345,22 @@ struct Command_Pool_Manager {
     // the right pool. Keeping another free list of pools allows new threads to grab the pool.
     Commands make();
 
+    // Secondary command buffers follow the same rules. They continue a dynamic rendering
+    // scope with the given attachment formats and are executed by a primary buffer.
+    Commands make_secondary(const Rendering_Formats& formats);
+
+    // Frame command buffers come from the thread's pool for the given frame slot, which is
+    // created without per-buffer reset. They must only be used within that frame: all pools
+    // of the slot are reset at once by reset_frame when the frame's previous use completes.
+    Commands make_frame(u32 frame);
+    void reset_frame(u32 frame);
+
 private:
-    explicit Command_Pool_Manager(Arc<Device, Alloc> device);
+    explicit Command_Pool_Manager(Arc<Device, Alloc> device, u32 frames_in_flight);
     friend struct Arc<Command_Pool_Manager, Alloc>;
 
     void begin_thread();
+    void begin_frame_thread();
     void end_thread();
 
     struct This_Thread {
@@ -164,14 +368,18 @@ private:
             if(pool_manager.ok()) pool_manager->end_thread();
         }
         Arc<Command_Pool, Alloc> pool;
+        Vec<Arc<Command_Pool, Alloc>, Alloc> frame_pools;
         Ref<Command_Pool_Manager> pool_manager;
     };
 
     static inline thread_local This_Thread this_thread;
 
     Arc<Device, Alloc> device;
+    u32 frames_in_flight = 0;
 
     Vec<Arc<Command_Pool, Alloc>, Alloc> free_list;
+    Vec<Vec<Arc<Command_Pool, Alloc>, Alloc>, Alloc> free_frame_pools;
+    Vec<Vec<Arc<Command_Pool, Alloc>, Alloc>, Alloc> frame_pools;
     Map<Thread::Id, Empty<>, Alloc> active_threads;
     Thread::Mutex mutex;
 };
@@ -0,0 +1,348 @@
+
+#include <imgui/imgui.h>
+
+#include "defrag.h"
+#include "rvk.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+Defragmenter::Defragmenter(Arc<Device, Alloc> D,
+                           Arc<Command_Pool_Manager<Queue_Family::transfer>, Alloc> P,
+                           Timeline timeline, u64 budget, Callback callback)
+    : device(move(D)), transfer_pool(move(P)), callback(move(callback)), budget(budget),
+      timeline(move(timeline)) {
+}
+
+Defragmenter::~Defragmenter() {
+    for(auto& batch : pending) {
+        batch.fence.wait();
+        cancel(batch);
+    }
+    pending.clear();
+    if(moved_resources) {
+        info("[rvk] Defragmenter moved %mb in % resource(s).", moved_bytes / Math::MB(1),
+             moved_resources);
+    }
+}
+
+void Defragmenter::imgui() {
+    using namespace ImGui;
+    Text("Budget: %lumb/frame | Pending batches: %lu", budget / Math::MB(1), pending.length());
+    Text("Moved: %lumb in %lu resource(s)", moved_bytes / Math::MB(1), moved_resources);
+}
+
+Opt<Sem_Ref> Defragmenter::step(Slice<Arc<Device_Memory, Alloc>> heaps, bool idle) {
+
+    if(!pending.empty()) {
+        Vec<Batch, Alloc> in_flight;
+        for(auto& batch : pending) {
+            if(batch.fence.ready()) {
+                apply(batch);
+            } else {
+                in_flight.push(move(batch));
+            }
+        }
+        pending = move(in_flight);
+    }
+
+    Opt<Commands> cmds;
+    Vec<Move, Alloc> moves;
+
+    u64 used = 0;
+    for(auto& heap : heaps) {
+        if(used >= budget) break;
+        used += start(*heap, cmds, moves, budget - used, idle);
+    }
+
+    if(moves.empty()) return {};
+
+    Region(R) {
+        Barriers<Mregion<R>> barriers;
+        barriers.memory(VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                        VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_ACCESS_2_MEMORY_READ_BIT);
+        barriers.flush(*cmds);
+    }
+    cmds->end();
+
+    bool has_images = false;
+    for(auto& entry : moves) {
+        if(entry.image) has_images = true;
+    }
+
+    Batch batch{Fence{device.dup()}, move(*cmds), move(moves)};
+
+    // Image copies change the source's layout, so the frame waits for them on the GPU.
+    if(!has_images) {
+        device->submit(batch.cmds, 0, batch.fence);
+        pending.push(move(batch));
+        return {};
+    }
+
+    Sem_Ref signal{timeline, ++timeline_value, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT};
+    device->submit(batch.cmds, 0, {}, Slice{&signal, 1}, batch.fence);
+    pending.push(move(batch));
+    return Opt{Sem_Ref{timeline, timeline_value, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT}};
+}
+
+u64 Defragmenter::start(Device_Memory& memory, Opt<Commands>& cmds, Vec<Move, Alloc>& moves,
+                        u64 limit, bool idle) {
+
+    Thread::Lock lock{memory.mutex};
+
+    // A single free range can't be compacted any further.
+    if(memory.allocator.statistics().free_blocks <= 1) return 0;
+
+    u64 used = 0;
+    for(auto& [offset, movable] : memory.movables) {
+        if(movable.moving) continue;
+        if(movable.image && !idle) continue;
+
+        u64 size =
+            movable.buffer ? movable.buffer->allocation_size : movable.image->allocation_size;
+        if(used + size > limit) continue;
+
+        // Size class blocks are recycled through the thread caches, so moving them gains nothing.
+        if(memory.cache_class(size).ok()) continue;
+
+        Device_Memory::Requirements requirements;
+        VkBuffer buffer = null;
+        VkImage image = null;
+        if(movable.buffer) {
+            buffer = memory.create(movable.buffer->len, movable.buffer->usage_, requirements);
+        } else {
+            Image& src = *movable.image;
+            image = memory.create(src.extent_, src.format_, src.usage_, requirements);
+        }
+
+        auto address =
+            memory.allocator.allocate(requirements.memory.size,
+                                      Math::max(requirements.memory.alignment,
+                                                memory.buffer_image_granularity));
+
+        // Only move towards the start of the heap.
+        if(!address.ok() || (*address)->offset >= offset) {
+            if(address.ok()) memory.allocator.free(*address);
+            if(buffer) vkDestroyBuffer(*device, buffer, null);
+            if(image) vkDestroyImage(*device, image, null);
+            continue;
+        }
+
+        if(!cmds.ok()) cmds.emplace(transfer_pool->make());
+
+        if(buffer) {
+            memory.bind(buffer, (*address)->offset);
+
+            VkBufferCopy2 region = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+                .srcOffset = 0,
+                .dstOffset = 0,
+                .size = movable.buffer->len,
+            };
+
+            VkCopyBufferInfo2 info = {
+                .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
+                .srcBuffer = *movable.buffer,
+                .dstBuffer = buffer,
+                .regionCount = 1,
+                .pRegions = &region,
+            };
+
+            vkCmdCopyBuffer2(*cmds, &info);
+        } else {
+            memory.bind(image, (*address)->offset);
+
+            Image& src = *movable.image;
+            VkImageAspectFlags aspect = src.aspect();
+
+            Region(R) {
+                Barriers<Mregion<R>> barriers;
+                image_barrier(barriers, src, aspect, movable.layout,
+                              VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                              VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE,
+                              VK_ACCESS_2_TRANSFER_READ_BIT);
+                image_barrier(barriers, image, aspect, VK_IMAGE_LAYOUT_UNDEFINED,
+                              VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT, VK_ACCESS_2_NONE,
+                              VK_ACCESS_2_TRANSFER_WRITE_BIT);
+                barriers.flush(*cmds);
+            }
+
+            VkImageCopy2 region = {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_COPY_2,
+                .srcSubresource =
+                    {
+                        .aspectMask = aspect,
+                        .mipLevel = 0,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                .srcOffset = {0, 0, 0},
+                .dstSubresource =
+                    {
+                        .aspectMask = aspect,
+                        .mipLevel = 0,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                .dstOffset = {0, 0, 0},
+                .extent = src.extent_,
+            };
+
+            VkCopyImageInfo2 info = {
+                .sType = VK_STRUCTURE_TYPE_COPY_IMAGE_INFO_2,
+                .srcImage = src,
+                .srcImageLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                .dstImage = image,
+                .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .regionCount = 1,
+                .pRegions = &region,
+            };
+
+            vkCmdCopyImage2(*cmds, &info);
+
+            // The source stays in use until the move is applied, so it returns to its layout.
+            Region(R) {
+                Barriers<Mregion<R>> barriers;
+                image_barrier(barriers, src, aspect, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                              movable.layout, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                              VK_ACCESS_2_NONE, VK_ACCESS_2_NONE);
+                image_barrier(barriers, image, aspect, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                              movable.layout, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
+                              VK_ACCESS_2_TRANSFER_WRITE_BIT, VK_ACCESS_2_MEMORY_READ_BIT);
+                barriers.flush(*cmds);
+            }
+        }
+
+        movable.moving = true;
+        memory.moves_in_flight.incr();
+        moves.push(Move{Arc<Device_Memory, Alloc>::from_this(&memory), offset, buffer, image,
+                        *address, requirements.memory.size});
+        used += size;
+    }
+
+    return used;
+}
+
+void Defragmenter::apply(Batch& batch) {
+    Region(R) {
+        Vec<Relocation, Mregion<R>> relocations;
+
+        for(auto& entry : batch.moves) {
+            Device_Memory& memory = *entry.memory;
+            Relocation relocation;
+            {
+                Thread::Lock lock{memory.mutex};
+
+                // The resource was detached, destroyed, or re-registered while its copy was
+                // in flight.
+                if(!memory.movables.contains(entry.offset) ||
+                   !memory.movables.get(entry.offset).moving ||
+                   (!memory.movables.get(entry.offset).buffer &&
+                    !memory.movables.get(entry.offset).image)) {
+                    discard(memory, entry);
+                    continue;
+                }
+
+                Device_Memory::Movable movable = memory.movables.get(entry.offset);
+                memory.movables.erase(entry.offset);
+                memory.moves_in_flight.decr();
+                movable.moving = false;
+
+                Heap_Allocator::Range old_address = null;
+                u64 old_size = 0;
+
+                if(movable.buffer) {
+                    Buffer& buffer = *movable.buffer;
+                    bool has_address = buffer.usage_ & VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+
+                    relocation.old_buffer = buffer.buffer;
+                    relocation.old_address = has_address ? buffer.gpu_address() : 0;
+
+                    old_address = buffer.address;
+                    old_size = buffer.allocation_size;
+                    buffer.buffer = entry.buffer;
+                    buffer.address = entry.address;
+                    buffer.allocation_size = entry.size;
+
+                    relocation.new_buffer = buffer.buffer;
+                    relocation.new_address = has_address ? buffer.gpu_address() : 0;
+
+                    drop([memory = entry.memory.dup(), handle = relocation.old_buffer, old_address,
+                          old_size]() {
+                        vkDestroyBuffer(*memory->device, handle, null);
+                        memory->release(old_address, old_size);
+                    });
+                } else {
+                    Image& image = *movable.image;
+
+                    relocation.old_image = image.image;
+
+                    old_address = image.address;
+                    old_size = image.allocation_size;
+                    image.image = entry.image;
+                    image.address = entry.address;
+                    image.allocation_size = entry.size;
+
+                    // The copy completed, so the new image has no pending accesses.
+                    for(auto& state : image.tracked) {
+                        state = Image::Tracked{.layout = movable.layout};
+                    }
+
+                    relocation.new_image = image.image;
+
+                    drop([memory = entry.memory.dup(), handle = relocation.old_image, old_address,
+                          old_size]() {
+                        vkDestroyImage(*memory->device, handle, null);
+                        memory->release(old_address, old_size);
+                    });
+                }
+
+                memory.movables.insert(entry.address->offset, movable);
+            }
+
+            moved_bytes += entry.size;
+            moved_resources++;
+            relocations.push(relocation);
+        }
+
+        // Outside the heap lock, since users will typically create views or write descriptors.
+        for(auto& relocation : relocations) {
+            callback(relocation);
+        }
+    }
+}
+
+void Defragmenter::cancel(Batch& batch) {
+    for(auto& entry : batch.moves) {
+        Device_Memory& memory = *entry.memory;
+        Thread::Lock lock{memory.mutex};
+        discard(memory, entry);
+    }
+    batch.moves.clear();
+}
+
+void Defragmenter::discard(Device_Memory& memory, Move& entry) {
+    // Called with the heap locked once the copy has completed.
+    if(entry.buffer) vkDestroyBuffer(*device, entry.buffer, null);
+    if(entry.image) vkDestroyImage(*device, entry.image, null);
+    memory.allocator.free(entry.address);
+    memory.moves_in_flight.decr();
+
+    if(!memory.movables.contains(entry.offset)) return;
+    Device_Memory::Movable& movable = memory.movables.get(entry.offset);
+    if(!movable.moving) return;
+    if(movable.buffer || movable.image) {
+        movable.moving = false;
+        return;
+    }
+
+    // The resource stopped being movable mid-copy, and may have been destroyed since.
+    if(movable.retired_buffer) vkDestroyBuffer(*device, movable.retired_buffer, null);
+    if(movable.retired_image) vkDestroyImage(*device, movable.retired_image, null);
+    if(movable.retired_address) memory.allocator.free(movable.retired_address);
+    memory.movables.erase(entry.offset);
+}
+
+} // namespace rvk::impl
@@ -0,0 +1,88 @@
+
+#pragma once
+
+#include <rpp/base.h>
+#include <rpp/rc.h>
+
+#include "fwd.h"
+
+#include "commands.h"
+#include "memory.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+// Reported after a movable resource has been relocated. Only the handles of the
+// relocated resource type are set; addresses are zero for buffers without device address usage.
+struct Relocation {
+    VkBuffer old_buffer = null;
+    VkBuffer new_buffer = null;
+    VkImage old_image = null;
+    VkImage new_image = null;
+    u64 old_address = 0;
+    u64 new_address = 0;
+};
+
+struct Defragmenter {
+
+    using Callback = Function<void(const Relocation&)>;
+
+    ~Defragmenter();
+
+    Defragmenter(const Defragmenter&) = delete;
+    Defragmenter& operator=(const Defragmenter&) = delete;
+    Defragmenter(Defragmenter&&) = delete;
+    Defragmenter& operator=(Defragmenter&&) = delete;
+
+    void imgui();
+
+    // Applies moves whose copies have completed, then starts copying movable resources to
+    // lower offsets, up to the per-frame byte budget. Copies run asynchronously on the
+    // transfer queue; the old resource remains valid until the move is applied. Images have to
+    // change layout to be copied, so they are only moved when no other work is in flight, and
+    // the returned semaphore must be waited on by the current frame.
+    Opt<Sem_Ref> step(Slice<Arc<Device_Memory, Alloc>> heaps, bool idle);
+
+private:
+    explicit Defragmenter(Arc<Device, Alloc> device,
+                          Arc<Command_Pool_Manager<Queue_Family::transfer>, Alloc> transfer_pool,
+                          Timeline timeline, u64 budget, Callback callback);
+    friend struct Arc<Defragmenter, Alloc>;
+
+    struct Move {
+        Arc<Device_Memory, Alloc> memory;
+        u64 offset = 0;
+        VkBuffer buffer = null;
+        VkImage image = null;
+        Heap_Allocator::Range address = null;
+        u64 size = 0;
+    };
+
+    struct Batch {
+        Fence fence;
+        Commands cmds;
+        Vec<Move, Alloc> moves;
+    };
+
+    u64 start(Device_Memory& memory, Opt<Commands>& cmds, Vec<Move, Alloc>& moves, u64 limit,
+              bool idle);
+    void apply(Batch& batch);
+    void cancel(Batch& batch);
+    void discard(Device_Memory& memory, Move& entry);
+
+    Arc<Device, Alloc> device;
+    Arc<Command_Pool_Manager<Queue_Family::transfer>, Alloc> transfer_pool;
+    Callback callback;
+    u64 budget = 0;
+
+    // Signaled by batches that move images, which frames using them must wait for.
+    Timeline timeline;
+    u64 timeline_value = 0;
+
+    Vec<Batch, Alloc> pending;
+    u64 moved_bytes = 0;
+    u64 moved_resources = 0;
+};
+
+} // namespace rvk::impl
@@ -0,0 +1,52 @@
+
+#include "deletion.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+void Deletion_Queue::push(Finalizer&& finalizer) {
+    finalizers.push(move(finalizer));
+}
+
+void Deletion_Queue::push(Buffer&& buffer) {
+    buffers.push(move(buffer));
+}
+
+void Deletion_Queue::push(Image&& image) {
+    images.push(move(image));
+}
+
+void Deletion_Queue::push(Image_View&& view) {
+    views.push(move(view));
+}
+
+void Deletion_Queue::push(Descriptor_Set&& set) {
+    sets.push(move(set));
+}
+
+void Deletion_Queue::retire() {
+    finalizers.retire();
+    sets.retire();
+    views.retire();
+    images.retire();
+    buffers.retire();
+}
+
+bool Deletion_Queue::destroy(Profile::Time_Point deadline) {
+    // Sets and views are destroyed before the images and buffers they refer to.
+    return finalizers.destroy(deadline) || sets.destroy(deadline) || views.destroy(deadline) ||
+           images.destroy(deadline) || buffers.destroy(deadline);
+}
+
+void Deletion_Queue::clear() {
+    retire();
+    static_cast<void>(destroy(RPP_UINT64_MAX));
+}
+
+u64 Deletion_Queue::retired_count() const {
+    return finalizers.retired_count() + sets.retired_count() + views.retired_count() +
+           images.retired_count() + buffers.retired_count();
+}
+
+} // namespace rvk::impl
@@ -0,0 +1,179 @@
+
+#pragma once
+
+#include <rpp/base.h>
+
+#include "fwd.h"
+
+#include "descriptors.h"
+#include "drop.h"
+#include "memory.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+// A lock-free list of resources waiting for their frame to complete. Any thread may push with
+// one compare and swap. A single thread retires everything pushed so far once the frame has
+// completed, then destroys the retired resources over as many calls as its budget requires.
+// Destroyed nodes go back to a recycled stack. A pushing thread takes the whole stack into its own
+// cache with one exchange, so nodes are reused without a per-drop allocation or ABA hazards.
+template<typename T>
+struct Deletion_List {
+
+    Deletion_List() = default;
+    ~Deletion_List() {
+        retire();
+        static_cast<void>(destroy(RPP_UINT64_MAX));
+        free_nodes(reinterpret_cast<Node*>(recycled.exchange(0)));
+    }
+
+    Deletion_List(const Deletion_List&) = delete;
+    Deletion_List& operator=(const Deletion_List&) = delete;
+
+    // Only used while no other thread can access the lists.
+    Deletion_List(Deletion_List&& src)
+        : head(src.head.exchange(0)), recycled(src.recycled.exchange(0)), retired(src.retired),
+          pending(src.pending) {
+        src.retired = null;
+        src.pending = 0;
+    }
+    Deletion_List& operator=(Deletion_List&&) = delete;
+
+    void push(T&& resource) {
+        Node* node = take();
+        node->resource = move(resource);
+        i64 prev = head.load();
+        for(;;) {
+            node->next = reinterpret_cast<Node*>(prev);
+            i64 current = head.compare_and_swap(prev, reinterpret_cast<i64>(node));
+            if(current == prev) break;
+            prev = current;
+        }
+    }
+
+    void retire() {
+        Node* list = reinterpret_cast<Node*>(head.exchange(0));
+        while(list) {
+            Node* next = list->next;
+            list->next = retired;
+            retired = list;
+            list = next;
+            pending++;
+        }
+    }
+
+    // Destroys retired resources until the deadline passes, and returns whether any remain.
+    [[nodiscard]] bool destroy(Profile::Time_Point deadline) {
+        Node* first = null;
+        Node* last = null;
+        bool remaining = false;
+        while(retired) {
+            if(Profile::timestamp() > deadline) {
+                remaining = true;
+                break;
+            }
+            Node* node = retired;
+            retired = node->next;
+            pending--;
+            {
+                T resource = move(node->resource);
+            }
+            node->next = first;
+            if(!last) last = node;
+            first = node;
+        }
+        if(first) recycle(first, last);
+        return remaining;
+    }
+
+    u64 retired_count() const {
+        return pending;
+    }
+
+private:
+    struct Node {
+        Node* next = null;
+        T resource;
+    };
+
+    struct This_Thread {
+        ~This_Thread() {
+            free_nodes(cache);
+        }
+        Node* cache = null;
+    };
+
+    static inline thread_local This_Thread this_thread;
+
+    Node* take() {
+        Node*& cache = this_thread.cache;
+        if(!cache) cache = reinterpret_cast<Node*>(recycled.exchange(0));
+        if(!cache) return Alloc::make<Node>();
+        Node* node = cache;
+        cache = node->next;
+        node->next = null;
+        return node;
+    }
+
+    void recycle(Node* first, Node* last) {
+        i64 prev = recycled.load();
+        for(;;) {
+            last->next = reinterpret_cast<Node*>(prev);
+            i64 current = recycled.compare_and_swap(prev, reinterpret_cast<i64>(first));
+            if(current == prev) break;
+            prev = current;
+        }
+    }
+
+    static void free_nodes(Node* list) {
+        while(list) {
+            Node* next = list->next;
+            Alloc::destroy(list);
+            list = next;
+        }
+    }
+
+    Thread::Atomic head;
+    Thread::Atomic recycled;
+    Node* retired = null;
+    u64 pending = 0;
+};
+
+// The resources dropped during one frame, by type.
+struct Deletion_Queue {
+
+    Deletion_Queue() = default;
+    ~Deletion_Queue() = default;
+
+    Deletion_Queue(const Deletion_Queue&) = delete;
+    Deletion_Queue& operator=(const Deletion_Queue&) = delete;
+    Deletion_Queue(Deletion_Queue&&) = default;
+    Deletion_Queue& operator=(Deletion_Queue&&) = delete;
+
+    void push(Finalizer&& finalizer);
+    void push(Buffer&& buffer);
+    void push(Image&& image);
+    void push(Image_View&& view);
+    void push(Descriptor_Set&& set);
+
+    // Called once the frame has completed.
+    void retire();
+
+    // Destroys retired resources until the deadline passes, and returns whether any remain.
+    [[nodiscard]] bool destroy(Profile::Time_Point deadline);
+
+    // Retires and destroys everything; the frame must have completed.
+    void clear();
+
+    u64 retired_count() const;
+
+private:
+    Deletion_List<Finalizer> finalizers;
+    Deletion_List<Descriptor_Set> sets;
+    Deletion_List<Image_View> views;
+    Deletion_List<Image> images;
+    Deletion_List<Buffer> buffers;
+};
+
+} // namespace rvk::impl
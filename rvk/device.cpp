@@ -3,6 +3,9 @@
 
 #include "commands.h"
 #include "device.h"
+#include "trace.h"
+
+#include <stdio.h>
 
 static VkPhysicalDeviceFeatures2* baseline_features(bool ray_tracing, bool robustness) {
 
@@ -83,6 +86,8 @@ static VkPhysicalDeviceFeatures2* baseline_features(bool ray_tracing, bool robus
         .imagelessFramebuffer = VK_TRUE,
         .uniformBufferStandardLayout = VK_TRUE,
         .separateDepthStencilLayouts = VK_TRUE,
+        .hostQueryReset = VK_TRUE,
+        .timelineSemaphore = VK_TRUE,
         .bufferDeviceAddress = VK_TRUE,
         .vulkanMemoryModel = VK_TRUE,
         .vulkanMemoryModelDeviceScope = VK_TRUE,
@@ -161,6 +166,23 @@ static VkPhysicalDeviceFeatures2* baseline_features(bool ray_tracing, bool robus
 
 namespace rvk::impl {
 
+static bool has_device_time_domain(VkPhysicalDevice device, bool khr) {
+    auto get_domains = khr ? vkGetPhysicalDeviceCalibrateableTimeDomainsKHR
+                           : vkGetPhysicalDeviceCalibrateableTimeDomainsEXT;
+    if(!get_domains) return false;
+
+    u32 n_domains = 0;
+    RVK_CHECK(get_domains(device, &n_domains, null));
+    Region(R) {
+        auto domains = Vec<VkTimeDomainKHR, Mregion<R>>::make(n_domains);
+        RVK_CHECK(get_domains(device, &n_domains, domains.data()));
+        for(auto domain : domains) {
+            if(domain == VK_TIME_DOMAIN_DEVICE_KHR) return true;
+        }
+    }
+    return false;
+}
+
 Physical_Device::Physical_Device(VkPhysicalDevice PD) : device(PD) {
 
     assert(device);
@@ -317,23 +339,23 @@ Pair<u64, u64> Physical_Device::heap_stat(u32 heap) {
     return Pair{budget.heapUsage[heap_idx], budget.heapBudget[heap_idx]};
 }
 
-Opt<u32> Physical_Device::heap_index(u32 mask, u32 type) {
+Opt<u32> Physical_Device::heap_index(u32 mask, u32 type, u32 excluded) {
     for(u32 i = 0; i < properties_.memory.memoryProperties.memoryTypeCount; i++) {
-        if((mask & (1 << i)) &&
-           (properties_.memory.memoryProperties.memoryTypes[i].propertyFlags & type) == type) {
+        u32 flags = properties_.memory.memoryProperties.memoryTypes[i].propertyFlags;
+        if((mask & (1 << i)) && (flags & type) == type && (flags & excluded) == 0) {
             return Opt<u32>{i};
         }
     }
     return {};
 }
 
-Opt<u32> Physical_Device::largest_heap(u32 type) {
+Opt<u32> Physical_Device::largest_heap(u32 type, u32 excluded) {
     Region(R) {
         Vec<Pair<u32, u64>, Mregion<R>> heaps(properties_.memory.memoryProperties.memoryTypeCount);
 
         for(u32 i = 0; i < properties_.memory.memoryProperties.memoryTypeCount; i++) {
-            if((properties_.memory.memoryProperties.memoryTypes[i].propertyFlags & type) == type) {
-                heaps.push(Pair{i, properties_.memory.memoryProperties.memoryHeaps[i].size});
+            if(heap_index(1 << i, type, excluded).ok()) {
+                heaps.push(Pair{i, heap_size(i)});
             }
         }
 
@@ -376,8 +398,8 @@ void Physical_Device::imgui() {
 }
 
 Device::Device(Arc<Physical_Device, Alloc> P, VkSurfaceKHR surface, bool ray_tracing,
-               bool robustness)
-    : physical_device(move(P)) {
+               bool robustness, bool threaded_submit, bool recycle_sync, bool balance_queues)
+    : physical_device(move(P)), balance_queues(balance_queues), recycle_sync(recycle_sync) {
 
     Profile::Time_Point start = Profile::timestamp();
 
@@ -486,6 +508,18 @@ Device::Device(Arc<Physical_Device, Alloc> P, VkSurfaceKHR surface, bool ray_tra
                         vk_extensions.push(ext);
                     }
                 }
+                // Optional: calibrated timestamps for the GPU profiler.
+                if(physical_device->supports_extension(
+                       String_View{VK_KHR_CALIBRATED_TIMESTAMPS_EXTENSION_NAME}) &&
+                   has_device_time_domain(*physical_device, true)) {
+                    vk_extensions.push(VK_KHR_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+                    calibrated_khr = true;
+                } else if(physical_device->supports_extension(
+                              String_View{VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME}) &&
+                          has_device_time_domain(*physical_device, false)) {
+                    vk_extensions.push(VK_EXT_CALIBRATED_TIMESTAMPS_EXTENSION_NAME);
+                    calibrated_ext = true;
+                }
             }
 
             // Create device
@@ -542,6 +576,50 @@ Device::Device(Arc<Physical_Device, Alloc> P, VkSurfaceKHR surface, bool ray_tra
             vkGetDeviceQueue2(device, &info, &present_q);
         }
 
+        { // Create queue locks, one per unique queue
+
+            auto add = [this](VkQueue queue) {
+                for(auto& submit_queue : submit_queues) {
+                    if(submit_queue->queue == queue) return;
+                }
+                VkSemaphoreTypeCreateInfo type_info = {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                    .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+                    .initialValue = 0,
+                };
+                VkSemaphoreCreateInfo sem_info = {
+                    .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                    .pNext = &type_info,
+                };
+                auto submit_queue = Box<Submit_Queue, Alloc>::make();
+                submit_queue->queue = queue;
+                RVK_CHECK(vkCreateSemaphore(device, &sem_info, null, &submit_queue->timeline));
+                submit_queues.push(move(submit_queue));
+            };
+            for(auto& queue : graphics_qs) add(queue);
+            for(auto& queue : compute_qs) add(queue);
+            for(auto& queue : transfer_qs) add(queue);
+            add(present_q);
+
+            VkSemaphoreTypeCreateInfo type_info = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+                .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+                .initialValue = 0,
+            };
+            VkSemaphoreCreateInfo sem_info = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+                .pNext = &type_info,
+            };
+            RVK_CHECK(vkCreateSemaphore(device, &sem_info, null, &fence_timeline));
+
+            if(threaded_submit) {
+                for(auto& submit_queue : submit_queues) {
+                    submit_threads.push(Thread::spawn(Run{this, &*submit_queue}));
+                }
+                info("[rvk] Started % submission thread(s).", submit_queues.length());
+            }
+        }
+
         info("[rvk] Got % graphics queues from family %.", n_graphics_queues,
              graphics_family_index);
         info("[rvk] Got % compute queues from family %.", n_compute_queues, compute_family_index);
@@ -576,9 +654,39 @@ Device::Device(Arc<Physical_Device, Alloc> P, VkSurfaceKHR surface, bool ray_tra
                 die("[rvk] No host cached heap found.");
             }
 
+            // Prefer write-combined memory for uploads, but any host coherent type will do.
+            if(auto idx = physical_device->largest_heap(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                                            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                                        VK_MEMORY_PROPERTY_HOST_CACHED_BIT |
+                                                            VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+               idx.ok()) {
+                upload_memory_index = *idx;
+            } else {
+                upload_memory_index = host_memory_index;
+            }
+
+            // Without resizable BAR, the device local host visible heap is only 256mb.
+            if(!physical_device->properties().is_discrete()) {
+                dynamic_memory_index = device_memory_index;
+                rebar = true;
+            } else if(auto idx = physical_device->largest_heap(
+                          VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT |
+                          VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                          VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+                      idx.ok()) {
+                dynamic_memory_index = *idx;
+                rebar = physical_device->heap_size(*idx) > Math::MB(256);
+            } else {
+                info("[rvk] No device local host visible heap, using upload heap as dynamic.");
+                dynamic_memory_index = upload_memory_index;
+            }
+
             info("[rvk] Found device and host heaps (%: %mb, %: %mb).", device_memory_index,
                  heap_size(Heap::device) / Math::MB(1), host_memory_index,
                  heap_size(Heap::host) / Math::MB(1));
+            info("[rvk] Found upload and dynamic heaps (%: %mb, %: %mb), resizable BAR: %.",
+                 upload_memory_index, heap_size(Heap::upload) / Math::MB(1),
+                 dynamic_memory_index, heap_size(Heap::dynamic) / Math::MB(1), rebar);
         }
 
         volkLoadDevice(device);
@@ -590,8 +698,25 @@ Device::Device(Arc<Physical_Device, Alloc> P, VkSurfaceKHR surface, bool ray_tra
 }
 
 Device::~Device() {
+    for(auto& submit_queue : submit_queues) {
+        Thread::Lock lock{submit_queue->mutex};
+        submit_queue->stop = true;
+        submit_queue->cond.broadcast();
+    }
+    for(auto& thread : submit_threads) {
+        thread->block();
+    }
+    submit_threads.clear();
     if(device) {
         vkDeviceWaitIdle(device);
+        for(auto& submit_queue : submit_queues) {
+            vkDestroySemaphore(device, submit_queue->timeline, null);
+        }
+        vkDestroySemaphore(device, fence_timeline, null);
+        for(auto& [id, cache] : pipeline_caches) vkDestroyPipelineCache(device, cache, null);
+        for(VkFence fence : free_fences) vkDestroyFence(device, fence, null);
+        for(VkFence fence : pending_fences) vkDestroyFence(device, fence, null);
+        for(VkSemaphore semaphore : free_semaphores) vkDestroySemaphore(device, semaphore, null);
         vkDestroyDevice(device, null);
         info("[rvk] Destroyed device.");
     }
@@ -602,22 +727,53 @@ u32 Device::heap_index(Heap heap) {
     switch(heap) {
     case Heap::device: return device_memory_index;
     case Heap::host: return host_memory_index;
+    case Heap::upload: return upload_memory_index;
+    case Heap::dynamic: return dynamic_memory_index;
     default: RPP_UNREACHABLE;
     }
 }
 
 u64 Device::heap_size(Heap heap) {
-    switch(heap) {
-    case Heap::device: return physical_device->heap_size(device_memory_index);
-    case Heap::host: return physical_device->heap_size(host_memory_index);
-    default: RPP_UNREACHABLE;
-    }
+    return physical_device->heap_size(heap_index(heap));
+}
+
+bool Device::host_visible(Heap heap) {
+    const auto& memory = physical_device->properties().memory.memoryProperties;
+    return memory.memoryTypes[heap_index(heap)].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+}
+
+bool Device::has_rebar() {
+    return rebar;
+}
+
+Pair<u64, u64> Device::heap_stat(Heap heap) {
+    return physical_device->heap_stat(heap_index(heap));
 }
 
 u64 Device::non_coherent_atom_size() {
     return physical_device->properties().device.properties.limits.nonCoherentAtomSize;
 }
 
+u64 Device::copy_offset_alignment() {
+    return physical_device->properties().device.properties.limits.optimalBufferCopyOffsetAlignment;
+}
+
+u64 Device::buffer_offset_alignment(VkBufferUsageFlags usage) {
+    const auto& limits = physical_device->properties().device.properties.limits;
+    u64 alignment = 16;
+    if(usage & VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT) {
+        alignment = Math::max(alignment, limits.minUniformBufferOffsetAlignment);
+    }
+    if(usage & VK_BUFFER_USAGE_STORAGE_BUFFER_BIT) {
+        alignment = Math::max(alignment, limits.minStorageBufferOffsetAlignment);
+    }
+    if(usage &
+       (VK_BUFFER_USAGE_UNIFORM_TEXEL_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_TEXEL_BUFFER_BIT)) {
+        alignment = Math::max(alignment, limits.minTexelBufferOffsetAlignment);
+    }
+    return alignment;
+}
+
 u64 Device::sbt_handle_size() {
     return physical_device->properties().ray_tracing.shaderGroupHandleSize;
 }
@@ -646,6 +802,26 @@ VkQueue Device::queue(Queue_Family family, u32 index) {
     }
 }
 
+Opt<u64> Device::device_timestamp() {
+    VkCalibratedTimestampInfoKHR info = {
+        .sType = VK_STRUCTURE_TYPE_CALIBRATED_TIMESTAMP_INFO_KHR,
+        .timeDomain = VK_TIME_DOMAIN_DEVICE_KHR,
+    };
+    u64 timestamp = 0, deviation = 0;
+    if(calibrated_khr) {
+        RVK_CHECK(vkGetCalibratedTimestampsKHR(device, 1, &info, &timestamp, &deviation));
+    } else if(calibrated_ext) {
+        RVK_CHECK(vkGetCalibratedTimestampsEXT(device, 1, &info, &timestamp, &deviation));
+    } else {
+        return {};
+    }
+    return Opt{timestamp};
+}
+
+u32 Physical_Device::timestamp_bits(u32 family) {
+    return available_families[family].queueFamilyProperties.timestampValidBits;
+}
+
 u32 Device::queue_index(Queue_Family family) {
     switch(family) {
     case Queue_Family::transfer: return transfer_family_index;
@@ -656,86 +832,108 @@ u32 Device::queue_index(Queue_Family family) {
     }
 }
 
+struct Device::Packet {
+    Packet* next = null;
+    Submit_Batch batch;
+    VkFence fence = null;
+};
+
 void Device::lock_queues() {
-    mutex.lock();
+    for(auto& submit_queue : submit_queues) {
+        submit_queue->mutex.lock();
+    }
 }
 
 void Device::unlock_queues() {
-    mutex.unlock();
+    for(u64 i = submit_queues.length(); i > 0; i--) {
+        submit_queues[i - 1]->mutex.unlock();
+    }
+}
+
+Device::Submit_Queue& Device::submit_queue(VkQueue queue) {
+    for(auto& submit_queue : submit_queues) {
+        if(submit_queue->queue == queue) return *submit_queue;
+    }
+    RPP_UNREACHABLE;
 }
 
 VkResult Device::present(const VkPresentInfoKHR& info) {
-    Thread::Lock lock(mutex);
+    // The wait semaphores are binary, so their signals must have reached the driver.
+    auto& present_queue = submit_queue(present_q);
+    flush_others(present_queue);
+    flush(present_queue);
+    Thread::Lock lock(present_queue.mutex);
     return vkQueuePresentKHR(present_q, &info);
 }
 
 void Device::wait_idle() {
-    Thread::Lock lock(mutex);
+    for(auto& submit_queue : submit_queues) {
+        flush(*submit_queue);
+    }
+    lock_queues();
     RVK_CHECK(vkDeviceWaitIdle(device));
+    unlock_queues();
 }
 
 void Device::submit(Commands& cmds, u32 index) {
+    submit(cmds, index, {}, {}, VkFence{null});
+}
 
-    VkCommandBufferSubmitInfo cmd_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
-        .commandBuffer = cmds,
-    };
+void Device::submit(Commands& cmds, u32 index, Fence& fence) {
+    fence.reset();
+    submit(cmds, index, {}, {}, VkFence{fence});
+}
 
-    VkSubmitInfo2 submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
-        .commandBufferInfoCount = 1,
-        .pCommandBufferInfos = &cmd_info,
-    };
+void Device::submit(Commands& cmds, u32 index, Slice<const Sem_Ref> wait,
+                    Slice<const Sem_Ref> signal) {
+    submit(cmds, index, wait, signal, VkFence{null});
+}
 
-    {
-        Thread::Lock lock(mutex);
-        RVK_CHECK(vkQueueSubmit2(queue(cmds.family(), index), 1, &submit_info, null));
-    }
+void Device::submit(Commands& cmds, u32 index, Slice<const Sem_Ref> wait,
+                    Slice<const Sem_Ref> signal, Fence& fence) {
+    fence.reset();
+    submit(cmds, index, wait, signal, VkFence{fence});
 }
 
-void Device::submit(Commands& cmds, u32 index, Fence& fence) {
+void Device::submit(Commands& cmds, u32 index, Slice<const Sem_Ref> wait,
+                    Slice<const Sem_Ref> signal, VkFence fence) {
 
-    VkCommandBufferSubmitInfo cmd_info = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
-        .commandBuffer = cmds,
-    };
+    cmds.submitted(index);
 
-    VkSubmitInfo2 submit_info = {
-        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
-        .commandBufferInfoCount = 1,
-        .pCommandBufferInfos = &cmd_info,
-    };
+    auto& target = submit_queue(queue(cmds.family(), index));
 
-    fence.reset();
-    {
-        Thread::Lock lock(mutex);
-        RVK_CHECK(vkQueueSubmit2(queue(cmds.family(), index), 1, &submit_info, fence));
+    if(!submit_threads.empty()) {
+        auto packet = Alloc::make<Packet>();
+        packet->batch.add(cmds, index, wait, signal);
+        packet->fence = fence;
+        if(packet->batch.binary_waits()) flush_others(target);
+        push(target, packet);
+        return;
     }
-}
-
-void Device::submit(Commands& cmds, u32 index, Slice<const Sem_Ref> signal,
-                    Slice<const Sem_Ref> wait) {
 
     Region(R) {
 
-        Vec<VkSemaphoreSubmitInfo, Mregion<R>> vk_signal(signal.length());
         Vec<VkSemaphoreSubmitInfo, Mregion<R>> vk_wait(wait.length());
+        Vec<VkSemaphoreSubmitInfo, Mregion<R>> vk_signal(signal.length());
 
-        for(u64 i = 0; i < signal.length(); i++) {
+        // Values are ignored for binary semaphores.
+        for(u64 i = 0; i < wait.length(); i++) {
             VkSemaphoreSubmitInfo info = {
                 .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-                .semaphore = *signal[i].sem,
-                .stageMask = signal[i].stage,
+                .semaphore = wait[i].sem,
+                .value = wait[i].value,
+                .stageMask = wait[i].stage,
             };
-            vk_signal.push(info);
+            vk_wait.push(info);
         }
-        for(u64 i = 0; i < wait.length(); i++) {
+        for(u64 i = 0; i < signal.length(); i++) {
             VkSemaphoreSubmitInfo info = {
                 .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-                .semaphore = *wait[i].sem,
-                .stageMask = wait[i].stage,
+                .semaphore = signal[i].sem,
+                .value = signal[i].value,
+                .stageMask = signal[i].stage,
             };
-            vk_wait.push(info);
+            vk_signal.push(info);
         }
 
         VkCommandBufferSubmitInfo cmd_info = {
@@ -754,58 +952,487 @@ void Device::submit(Commands& cmds, u32 index, Slice<const Sem_Ref> signal,
         };
 
         {
-            Thread::Lock lock(mutex);
-            RVK_CHECK(vkQueueSubmit2(queue(cmds.family(), index), 1, &submit_info, null));
+            Thread::Lock lock(target.mutex);
+            queue_submit(target, Slice{submit_info}, fence);
         }
     }
 }
 
-void Device::submit(Commands& cmds, u32 index, Slice<const Sem_Ref> signal,
-                    Slice<const Sem_Ref> wait, Fence& fence) {
+void Device::submit(Submit_Batch& batch) {
 
-    Region(R) {
+    if(batch.empty()) return;
 
-        Vec<VkSemaphoreSubmitInfo, Mregion<R>> vk_signal(signal.length());
-        Vec<VkSemaphoreSubmitInfo, Mregion<R>> vk_wait(wait.length());
+    Region(R) {
 
-        for(u64 i = 0; i < signal.length(); i++) {
-            VkSemaphoreSubmitInfo info = {
-                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-                .semaphore = *signal[i].sem,
-                .stageMask = signal[i].stage,
-            };
-            vk_signal.push(info);
+        Vec<Pair<Queue_Family, u32>, Mregion<R>> queues;
+        for(auto& entry : batch.entries) {
+            bool found = false;
+            for(auto& [family, index] : queues) {
+                found = found || (family == entry.family && index == entry.index);
+            }
+            if(!found) queues.push(Pair{entry.family, entry.index});
         }
-        for(u64 i = 0; i < wait.length(); i++) {
-            VkSemaphoreSubmitInfo info = {
-                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
-                .semaphore = *wait[i].sem,
-                .stageMask = wait[i].stage,
-            };
-            vk_wait.push(info);
+
+        Vec<VkSubmitInfo2, Mregion<R>> submit_infos(batch.entries.length());
+        for(auto& [family, index] : queues) {
+
+            auto& target = submit_queue(queue(family, index));
+
+            if(!submit_threads.empty()) {
+                auto packet = Alloc::make<Packet>();
+                for(auto& entry : batch.entries) {
+                    if(entry.family == family && entry.index == index) {
+                        packet->batch.append(batch, entry);
+                    }
+                }
+                if(packet->batch.binary_waits()) flush_others(target);
+                push(target, packet);
+                continue;
+            }
+
+            submit_infos.clear();
+            for(auto& entry : batch.entries) {
+                if(entry.family != family || entry.index != index) continue;
+                submit_infos.push(VkSubmitInfo2{
+                    .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+                    .waitSemaphoreInfoCount = entry.wait_count,
+                    .pWaitSemaphoreInfos = batch.waits.data() + entry.wait_offset,
+                    .commandBufferInfoCount = entry.cmds_count,
+                    .pCommandBufferInfos = batch.cmds.data() + entry.cmds_offset,
+                    .signalSemaphoreInfoCount = entry.signal_count,
+                    .pSignalSemaphoreInfos = batch.signals.data() + entry.signal_offset,
+                });
+            }
+
+            Thread::Lock lock(target.mutex);
+            queue_submit(target, submit_infos.slice(), null);
         }
+    }
 
-        VkCommandBufferSubmitInfo cmd_info = {
-            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
-            .commandBuffer = cmds,
+    batch.clear();
+}
+
+void Device::queue_submit(Submit_Queue& target, Slice<const VkSubmitInfo2> infos,
+                          VkFence fence) {
+
+    // Called with the queue locked. Plain submissions skip the queue timeline unless load is
+    // being tracked.
+    if(!fence && !balance_queues) {
+        Event_Scope scope{"Submit"_v};
+        RVK_CHECK(vkQueueSubmit2(target.queue, static_cast<u32>(infos.length()), infos.data(),
+                                 null));
+        return;
+    }
+
+    // A queue submission's signal covers all work submitted to the queue before it, so the
+    // timeline is signaled by a trailing submit info.
+    Region(R) {
+        u64 work = 0;
+        for(auto& info : infos) work += info.commandBufferInfoCount;
+        u64 value = static_cast<u64>(target.signaled.load()) + Math::max(work, u64{1});
+
+        VkSemaphoreSubmitInfo signal = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = target.timeline,
+            .value = value,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT,
         };
 
-        VkSubmitInfo2 submit_info = {
+        Vec<VkSubmitInfo2, Mregion<R>> all(infos.length() + 1);
+        for(auto& info : infos) all.push(info);
+        all.push(VkSubmitInfo2{
             .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
-            .waitSemaphoreInfoCount = static_cast<u32>(vk_wait.length()),
-            .pWaitSemaphoreInfos = vk_wait.data(),
-            .commandBufferInfoCount = 1,
-            .pCommandBufferInfos = &cmd_info,
-            .signalSemaphoreInfoCount = static_cast<u32>(vk_signal.length()),
-            .pSignalSemaphoreInfos = vk_signal.data(),
+            .signalSemaphoreInfoCount = 1,
+            .pSignalSemaphoreInfos = &signal,
+        });
+
+        Event_Scope scope{"Submit"_v};
+        RVK_CHECK(vkQueueSubmit2(target.queue, static_cast<u32>(all.length()), all.data(), fence));
+        target.signaled.store(static_cast<i64>(value));
+
+        if(fence) {
+            Thread::Lock lock{fence_mutex};
+            u64 key = reinterpret_cast<u64>(fence);
+            if(fence_signals.contains(key)) fence_signals.erase(key);
+            fence_signals.insert(key, Fence_Signal{target.timeline, value});
+
+            VkSemaphoreSignalInfo info = {
+                .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO,
+                .semaphore = fence_timeline,
+                .value = ++fence_submitted,
+            };
+            RVK_CHECK(vkSignalSemaphore(device, &info));
+        }
+    }
+}
+
+Device::Fence_Wait Device::fence_wait(VkFence fence) {
+    Thread::Lock lock{fence_mutex};
+
+    VkResult result = vkGetFenceStatus(device, fence);
+    if(result != VK_SUCCESS && result != VK_NOT_READY) RVK_CHECK(result);
+    if(result == VK_SUCCESS) return Fence_Wait{.signaled = true};
+
+    u64 key = reinterpret_cast<u64>(fence);
+    if(!fence_signals.contains(key)) return Fence_Wait{};
+
+    // The fence and the timeline value are signaled by the same submission, so reaching the
+    // value means its work has completed even if the fence status lags behind.
+    Fence_Signal signal = fence_signals.get(key);
+    u64 completed = 0;
+    RVK_CHECK(vkGetSemaphoreCounterValue(device, signal.timeline, &completed));
+    return Fence_Wait{
+        .signaled = completed >= signal.value,
+        .timeline = signal.timeline,
+        .value = signal.value,
+    };
+}
+
+void Device::reset_fence(VkFence fence) {
+    Thread::Lock lock{fence_mutex};
+    u64 key = reinterpret_cast<u64>(fence);
+    if(fence_signals.contains(key)) fence_signals.erase(key);
+    RVK_CHECK(vkResetFences(device, 1, &fence));
+}
+
+Pair<VkSemaphore, u64> Device::fence_submissions() {
+    Thread::Lock lock{fence_mutex};
+    return Pair{fence_timeline, fence_submitted};
+}
+
+u32 Device::least_loaded(Queue_Family family) {
+
+    if(!balance_queues) return 0;
+
+    u32 best = 0;
+    u64 best_load = RPP_UINT64_MAX;
+
+    // Ties go to the lower index, which has the higher priority.
+    u64 count = queue_count(family);
+    for(u32 i = 0; i < count; i++) {
+        auto& target = submit_queue(queue(family, i));
+        u64 completed = 0;
+        RVK_CHECK(vkGetSemaphoreCounterValue(device, target.timeline, &completed));
+        u64 signaled = static_cast<u64>(target.signaled.load());
+        u64 load = signaled > completed ? signaled - completed : 0;
+        if(load < best_load) {
+            best = i;
+            best_load = load;
+        }
+    }
+    return best;
+}
+
+u32 Device::submit_balanced(Commands& cmds, Slice<const Sem_Ref> wait,
+                            Slice<const Sem_Ref> signal) {
+    u32 index = least_loaded(cmds.family());
+    submit(cmds, index, wait, signal, VkFence{null});
+    return index;
+}
+
+void Device::push(Submit_Queue& target, Packet* packet) {
+
+    i64 head = target.head.load();
+    for(;;) {
+        packet->next = reinterpret_cast<Packet*>(head);
+        i64 prev = target.head.compare_and_swap(head, reinterpret_cast<i64>(packet));
+        if(prev == head) break;
+        head = prev;
+    }
+    target.pushed.incr();
+
+    // The thread sets sleeping before checking the list under the lock, so either it sees
+    // the packet or we see that it is sleeping.
+    if(target.sleeping.load()) {
+        Thread::Lock lock{target.mutex};
+        target.cond.broadcast();
+    }
+}
+
+void Device::flush(Submit_Queue& target) {
+    if(submit_threads.empty()) return;
+    u64 pushed = static_cast<u64>(target.pushed.load());
+    Thread::Lock lock{target.mutex};
+    while(target.submitted < pushed) {
+        target.cond.wait(target.mutex);
+    }
+}
+
+void Device::flush_others(Submit_Queue& target) {
+    for(auto& submit_queue : submit_queues) {
+        if(&*submit_queue != &target) flush(*submit_queue);
+    }
+}
+
+void Device::run(Submit_Queue& target) {
+
+    for(;;) {
+        auto list = reinterpret_cast<Packet*>(target.head.exchange(0));
+
+        if(!list) {
+            Thread::Lock lock{target.mutex};
+            target.sleeping.store(1);
+            if(!target.head.load() && !target.stop) {
+                target.cond.wait(target.mutex);
+            }
+            target.sleeping.store(0);
+            if(target.stop && !target.head.load()) return;
+            continue;
+        }
+
+        // Packets were pushed onto a stack, so reverse them into submission order.
+        Packet* packets = null;
+        u64 count = 0;
+        while(list) {
+            Packet* next = list->next;
+            list->next = packets;
+            packets = list;
+            list = next;
+            count++;
+        }
+
+        Region(R) {
+            Vec<VkSubmitInfo2, Mregion<R>> submit_infos;
+
+            Thread::Lock lock{target.mutex};
+            for(Packet* packet = packets; packet; packet = packet->next) {
+                auto& batch = packet->batch;
+                for(auto& entry : batch.entries) {
+                    submit_infos.push(VkSubmitInfo2{
+                        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+                        .waitSemaphoreInfoCount = entry.wait_count,
+                        .pWaitSemaphoreInfos = batch.waits.data() + entry.wait_offset,
+                        .commandBufferInfoCount = entry.cmds_count,
+                        .pCommandBufferInfos = batch.cmds.data() + entry.cmds_offset,
+                        .signalSemaphoreInfoCount = entry.signal_count,
+                        .pSignalSemaphoreInfos = batch.signals.data() + entry.signal_offset,
+                    });
+                }
+                // A fence covers every submission in its call, so close the call at each one.
+                if(packet->fence || !packet->next) {
+                    queue_submit(target, submit_infos.slice(), packet->fence);
+                    submit_infos.clear();
+                }
+            }
+            target.submitted += count;
+            target.cond.broadcast();
+        }
+
+        while(packets) {
+            Packet* next = packets->next;
+            Alloc::destroy(packets);
+            packets = next;
+        }
+    }
+}
+
+VkFence Device::acquire_fence() {
+    if(recycle_sync) {
+        Thread::Lock lock{sync_mutex};
+        if(free_fences.empty() && !pending_fences.empty()) {
+            Vec<VkFence, Alloc> in_flight;
+            for(VkFence fence : pending_fences) {
+                VkResult result = vkGetFenceStatus(device, fence);
+                if(result == VK_SUCCESS) {
+                    free_fences.push(fence);
+                } else if(result == VK_NOT_READY) {
+                    in_flight.push(fence);
+                } else {
+                    RVK_CHECK(result);
+                }
+            }
+            pending_fences = move(in_flight);
+        }
+        if(!free_fences.empty()) {
+            VkFence fence = free_fences.back();
+            free_fences.pop();
+            return fence;
+        }
+        created_fences++;
+    }
+
+    VkExportFenceCreateInfo export_info = {
+        .sType = VK_STRUCTURE_TYPE_EXPORT_FENCE_CREATE_INFO,
+#ifdef RPP_OS_WINDOWS
+        .handleTypes = VK_EXTERNAL_FENCE_HANDLE_TYPE_OPAQUE_WIN32_BIT,
+#else
+        .handleTypes = VK_EXTERNAL_FENCE_HANDLE_TYPE_OPAQUE_FD_BIT,
+#endif
+    };
+
+    VkFenceCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+        .pNext = &export_info,
+        .flags = VK_FENCE_CREATE_SIGNALED_BIT,
+    };
+
+    VkFence fence = null;
+    RVK_CHECK(vkCreateFence(device, &info, null, &fence));
+    return fence;
+}
+
+void Device::release_fence(VkFence fence) {
+    {
+        Thread::Lock lock{fence_mutex};
+        u64 key = reinterpret_cast<u64>(fence);
+        if(fence_signals.contains(key)) fence_signals.erase(key);
+    }
+    if(!recycle_sync) {
+        vkDestroyFence(device, fence, null);
+        return;
+    }
+    VkResult result = vkGetFenceStatus(device, fence);
+    if(result != VK_SUCCESS && result != VK_NOT_READY) RVK_CHECK(result);
+
+    Thread::Lock lock{sync_mutex};
+    if(result == VK_SUCCESS) {
+        free_fences.push(fence);
+    } else {
+        pending_fences.push(fence);
+    }
+}
+
+VkSemaphore Device::acquire_semaphore() {
+    if(recycle_sync) {
+        Thread::Lock lock{sync_mutex};
+        if(!free_semaphores.empty()) {
+            VkSemaphore semaphore = free_semaphores.back();
+            free_semaphores.pop();
+            return semaphore;
+        }
+        created_semaphores++;
+    }
+
+    VkSemaphoreCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+    };
+    VkSemaphore semaphore = null;
+    RVK_CHECK(vkCreateSemaphore(device, &info, null, &semaphore));
+    return semaphore;
+}
+
+void Device::release_semaphore(VkSemaphore semaphore, bool recycle) {
+    if(!recycle_sync || !recycle) {
+        vkDestroySemaphore(device, semaphore, null);
+        return;
+    }
+    Thread::Lock lock{sync_mutex};
+    free_semaphores.push(semaphore);
+}
+
+static bool valid_pipeline_cache(Slice<const u8> data, const VkPhysicalDeviceProperties& device) {
+    VkPipelineCacheHeaderVersionOne header;
+    if(data.length() < sizeof(header)) return false;
+    Libc::memcpy(&header, data.data(), sizeof(header));
+
+    if(header.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE) return false;
+    if(header.headerSize < sizeof(header) || header.headerSize > data.length()) return false;
+    if(header.vendorID != device.vendorID || header.deviceID != device.deviceID) return false;
+    for(u32 i = 0; i < VK_UUID_SIZE; i++) {
+        if(header.pipelineCacheUUID[i] != device.pipelineCacheUUID[i]) return false;
+    }
+    return true;
+}
+
+VkPipelineCache Device::pipeline_cache() {
+    Thread::Id id = Thread::this_id();
+    Thread::Lock lock{pipeline_cache_mutex};
+    if(pipeline_caches.contains(id)) return pipeline_caches.get(id);
+
+    VkPipelineCacheCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = pipeline_cache_data.length(),
+        .pInitialData = pipeline_cache_data.data(),
+    };
+    VkPipelineCache cache = null;
+    RVK_CHECK(vkCreatePipelineCache(device, &info, null, &cache));
+    pipeline_caches.insert(id, cache);
+    return cache;
+}
+
+void Device::load_pipeline_cache(String_View path) {
+    Profile::Time_Point start = Profile::timestamp();
+
+    auto data = Files::read(path);
+    if(!data.ok()) {
+        info("[rvk] No pipeline cache at %, starting cold.", path);
+        return;
+    }
+    const auto& properties = physical_device->properties().device.properties;
+    if(!valid_pipeline_cache(Slice<const u8>{data->data(), data->length()}, properties)) {
+        warn("[rvk] Pipeline cache at % is from a different device or driver, starting cold.",
+             path);
+        return;
+    }
+
+    Thread::Lock lock{pipeline_cache_mutex};
+    pipeline_cache_data = move(*data);
+    pipeline_cache_warm = true;
+
+    Profile::Time_Point end = Profile::timestamp();
+    info("[rvk] Loaded pipeline cache from % (%kb) in %ms.", path,
+         pipeline_cache_data.length() / 1024, Profile::ms(end - start));
+}
+
+bool Device::save_pipeline_cache(String_View path) {
+    Profile::Time_Point start = Profile::timestamp();
+
+    Thread::Lock lock{pipeline_cache_mutex};
+    if(pipeline_caches.empty()) return true;
+
+    info("[rvk] Created % pipelines in %ms with a % cache.", pipelines_created,
+         Profile::ms(pipeline_time), pipeline_cache_warm ? "warm"_v : "cold"_v);
+
+    Region(R) {
+        Vec<VkPipelineCache, Mregion<R>> sources(pipeline_caches.length());
+        for(auto& [id, cache] : pipeline_caches) sources.push(VkPipelineCache{cache});
+
+        VkPipelineCacheCreateInfo info = {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
         };
+        VkPipelineCache merged = null;
+        RVK_CHECK(vkCreatePipelineCache(device, &info, null, &merged));
+        RVK_CHECK(vkMergePipelineCaches(device, merged, static_cast<u32>(sources.length()),
+                                        sources.data()));
+
+        size_t size = 0;
+        RVK_CHECK(vkGetPipelineCacheData(device, merged, &size, null));
+        auto data = Vec<u8, Mregion<R>>::make(size);
+        RVK_CHECK(vkGetPipelineCacheData(device, merged, &size, data.data()));
+        vkDestroyPipelineCache(device, merged, null);
+
+        auto temporary = format<Mregion<R>>("%.tmp"_v, path);
+        if(!Files::write(temporary.view(), Slice<const u8>{data.data(), size})) {
+            warn("[rvk] Failed to write pipeline cache to %.", temporary.view());
+            return false;
+        }
 
-        fence.reset();
-        {
-            Thread::Lock lock(mutex);
-            RVK_CHECK(vkQueueSubmit2(queue(cmds.family(), index), 1, &submit_info, fence));
+        auto from = temporary.view().terminate<Mregion<R>>();
+        auto to = path.terminate<Mregion<R>>();
+#ifdef RPP_OS_WINDOWS
+        bool renamed = MoveFileExA(reinterpret_cast<const char*>(from.data()),
+                                   reinterpret_cast<const char*>(to.data()),
+                                   MOVEFILE_REPLACE_EXISTING);
+#else
+        bool renamed = ::rename(reinterpret_cast<const char*>(from.data()),
+                                reinterpret_cast<const char*>(to.data())) == 0;
+#endif
+        if(!renamed) {
+            warn("[rvk] Failed to replace pipeline cache at %.", path);
+            return false;
         }
+
+        Profile::Time_Point end = Profile::timestamp();
+        info("[rvk] Saved pipeline cache to % (%kb) in %ms.", path, size / 1024,
+             Profile::ms(end - start));
     }
+    return true;
+}
+
+void Device::record_pipeline(Profile::Time_Point duration) {
+    Thread::Lock lock{pipeline_cache_mutex};
+    pipelines_created++;
+    pipeline_time += duration;
 }
 
 void Device::imgui() {
@@ -813,6 +1440,9 @@ void Device::imgui() {
 
     Text("Device heap: %d (%d mb)", device_memory_index, heap_size(Heap::device) / Math::MB(1));
     Text("Host heap: %d (%d mb)", host_memory_index, heap_size(Heap::host) / Math::MB(1));
+    Text("Upload heap: %d (%d mb)", upload_memory_index, heap_size(Heap::upload) / Math::MB(1));
+    Text("Dynamic heap: %d (%d mb)%s", dynamic_memory_index,
+         heap_size(Heap::dynamic) / Math::MB(1), rebar ? " (resizable BAR)" : "");
     Text("Graphics family: %d", graphics_family_index);
     Text("Compute family: %d", compute_family_index);
     Text("Transfer family: %d", transfer_family_index);
@@ -822,6 +1452,19 @@ void Device::imgui() {
     Text("SBT handle size: %lu", sbt_handle_size());
     Text("SBT handle alignment: %lu", sbt_handle_alignment());
 
+    {
+        Thread::Lock lock{pipeline_cache_mutex};
+        Text("Pipelines: %lu in %.2fms | Cache: %s", pipelines_created, Profile::ms(pipeline_time),
+             pipeline_cache_warm ? "warm" : "cold");
+    }
+
+    if(recycle_sync) {
+        Thread::Lock lock{sync_mutex};
+        Text("Fences: %lu created | %lu free | %lu pending", created_fences, free_fences.length(),
+             pending_fences.length());
+        Text("Semaphores: %lu created | %lu free", created_semaphores, free_semaphores.length());
+    }
+
     if(TreeNode("Enabled Extensions")) {
         for(auto& ext : enabled_extensions) Text("%.*s", ext.length(), ext.data());
         TreePop();
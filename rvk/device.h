@@ -2,6 +2,7 @@
 #pragma once
 
 #include <rpp/base.h>
+#include <rpp/files.h>
 #include <rpp/rc.h>
 
 #include "fwd.h"
@@ -11,7 +12,17 @@ namespace rvk {
 using namespace rpp;
 
 enum class Queue_Family : u8 { graphics, present, compute, transfer };
-enum class Heap : u8 { device, host };
+// device: device local, not host visible.
+// host: host cached, for readback and general staging.
+// upload: host visible and uncached (write-combined), for CPU to GPU streaming.
+// dynamic: device local and host visible (resizable BAR), falling back to upload.
+enum class Heap : u8 { device, host, upload, dynamic };
+
+// How the CPU will access a buffer, which determines the heap it is allocated from.
+// gpu_only: device heap. upload: written once by the CPU, read by the GPU, upload heap.
+// readback: written by the GPU, read by the CPU, host heap. dynamic: rewritten by the CPU
+// every frame and read directly by the GPU, dynamic heap.
+enum class Intent : u8 { gpu_only, upload, readback, dynamic };
 
 namespace impl {
 
@@ -44,10 +55,12 @@ struct Physical_Device {
     u64 max_allocation();
     u64 heap_size(u32 heap);
     Pair<u64, u64> heap_stat(u32 heap);
-    Opt<u32> heap_index(u32 mask, u32 properties);
-    Opt<u32> largest_heap(u32 properties);
+    Opt<u32> heap_index(u32 mask, u32 properties, u32 excluded = 0);
+    Opt<u32> largest_heap(u32 properties, u32 excluded = 0);
 
     bool supports_extension(String_View name);
+    // Valid bits of timestamps written on queues of the family, or 0 if unsupported.
+    u32 timestamp_bits(u32 family);
     VkSurfaceCapabilitiesKHR capabilities(VkSurfaceKHR surface);
 
     const Properties& properties() const {
@@ -100,19 +113,67 @@ struct Device {
 
     u32 heap_index(Heap heap);
     u64 heap_size(Heap heap);
+    bool host_visible(Heap heap);
+    bool has_rebar();
+    // Current usage and budget of the heap reported by VK_EXT_memory_budget.
+    Pair<u64, u64> heap_stat(Heap heap);
 
     u64 non_coherent_atom_size();
+    u64 copy_offset_alignment();
+    u64 buffer_offset_alignment(VkBufferUsageFlags usage);
     u64 sbt_handle_size();
     u64 sbt_handle_alignment();
 
     u32 queue_index(Queue_Family family);
     u64 queue_count(Queue_Family family);
 
+    // Fences are created signaled and exportable. With recycling enabled, a released fence is
+    // reused once it has signaled, and a released semaphore immediately, so a recycled
+    // semaphore must not be released while it is signaled or has pending operations.
+    VkFence acquire_fence();
+    void release_fence(VkFence fence);
+    VkSemaphore acquire_semaphore();
+    void release_semaphore(VkSemaphore semaphore, bool recycle);
+
+    // Each thread creates pipelines through its own cache, seeded with the loaded data, so that
+    // threads don't contend on one cache. Saving merges the thread caches.
+    VkPipelineCache pipeline_cache();
+    // Ignores data written by a different device or driver version.
+    void load_pipeline_cache(String_View path);
+    // Writes to a temporary file first and renames it over path.
+    [[nodiscard]] bool save_pipeline_cache(String_View path);
+    void record_pipeline(Profile::Time_Point duration);
+
+    // Samples the device timestamp counter through VK_KHR_calibrated_timestamps or its EXT
+    // predecessor. Returns nothing if neither is available.
+    Opt<u64> device_timestamp();
+
     void submit(Commands& cmds, u32 index);
     void submit(Commands& cmds, u32 index, Fence& fence);
     void submit(Commands& cmds, u32 index, Slice<const Sem_Ref> wait, Slice<const Sem_Ref> signal);
     void submit(Commands& cmds, u32 index, Slice<const Sem_Ref> wait, Slice<const Sem_Ref> signal,
                 Fence& fence);
+    // Clears the batch, keeping its capacity.
+    void submit(Submit_Batch& batch);
+
+    // Fences can't be waited on together with semaphores, so each fenced submission also
+    // signals its queue's timeline, and the Timeline_Waiter waits on that value instead.
+    struct Fence_Wait {
+        bool signaled = false;
+        // Null if the fence has not been submitted since it was reset.
+        VkSemaphore timeline = null;
+        u64 value = 0;
+    };
+    Fence_Wait fence_wait(VkFence fence);
+    void reset_fence(VkFence fence);
+    // A host timeline advanced after each fenced submission, and its current value.
+    Pair<VkSemaphore, u64> fence_submissions();
+
+    // Picks the queue of the family with the fewest command buffers in flight. Without
+    // balance_queues, load is not tracked and this is always the first queue.
+    u32 least_loaded(Queue_Family family);
+    // Submits to the least loaded queue of the command buffer's family and returns its index.
+    u32 submit_balanced(Commands& cmds, Slice<const Sem_Ref> wait, Slice<const Sem_Ref> signal);
 
     operator VkDevice() const {
         return device;
@@ -123,16 +184,54 @@ struct Device {
 
 private:
     explicit Device(Arc<Physical_Device, Alloc> physical_device, VkSurfaceKHR surface,
-                    bool ray_tracing, bool robustness);
+                    bool ray_tracing, bool robustness, bool threaded_submit, bool recycle_sync,
+                    bool balance_queues);
     friend struct Arc<Device, Alloc>;
     friend struct Vk;
     friend struct Compositor;
 
-    // TODO(max): lock per queue
     void lock_queues();
     void unlock_queues();
     VkQueue queue(Queue_Family family, u32 index = 0);
 
+    void submit(Commands& cmds, u32 index, Slice<const Sem_Ref> wait, Slice<const Sem_Ref> signal,
+                VkFence fence);
+
+    // Each unique VkQueue has its own lock. Families without dedicated queues alias the
+    // graphics queues, so they share locks. In threaded mode, each queue also has a thread
+    // that drains a lock-free list of packets pushed by producers and submits them together.
+    struct Packet;
+
+    struct Submit_Queue {
+        VkQueue queue = null;
+        Thread::Mutex mutex;
+        Thread::Cond cond;
+        Thread::Atomic head;
+        Thread::Atomic sleeping;
+        Thread::Atomic pushed;
+        u64 submitted = 0;
+        bool stop = false;
+        // Advanced by the number of command buffers in each balanced or fenced vkQueueSubmit2
+        // call, so the gap between the counter and the semaphore estimates pending work.
+        VkSemaphore timeline = null;
+        Thread::Atomic signaled;
+    };
+
+    struct Run {
+        Device* device;
+        Submit_Queue* queue;
+        void operator()() {
+            device->run(*queue);
+        }
+    };
+
+    Submit_Queue& submit_queue(VkQueue queue);
+    void queue_submit(Submit_Queue& queue, Slice<const VkSubmitInfo2> infos, VkFence fence);
+    void push(Submit_Queue& queue, Packet* packet);
+    void flush(Submit_Queue& queue);
+    void flush_others(Submit_Queue& queue);
+    void run(Submit_Queue& queue);
+
     Arc<Physical_Device, Alloc> physical_device;
     Vec<String<Alloc>, Alloc> enabled_extensions;
 
@@ -140,17 +239,52 @@ private:
 
     u32 device_memory_index = 0;
     u32 host_memory_index = 0;
+    u32 upload_memory_index = 0;
+    u32 dynamic_memory_index = 0;
+    bool rebar = false;
     u32 graphics_family_index = 0;
     u32 present_family_index = 0;
     u32 compute_family_index = 0;
     u32 transfer_family_index = 0;
+    bool calibrated_khr = false;
+    bool calibrated_ext = false;
 
     VkQueue present_q = null;
     Vec<VkQueue, Alloc> graphics_qs;
     Vec<VkQueue, Alloc> compute_qs;
     Vec<VkQueue, Alloc> transfer_qs;
 
-    Thread::Mutex mutex;
+    Vec<Box<Submit_Queue, Alloc>, Alloc> submit_queues;
+    Vec<decltype(Thread::spawn(Run{})), Alloc> submit_threads;
+    bool balance_queues = false;
+
+    // Free fences are signaled. Released fences that are still in flight are checked again
+    // when no free fence is left.
+    bool recycle_sync = false;
+    Thread::Mutex sync_mutex;
+    Vec<VkFence, Alloc> free_fences;
+    Vec<VkFence, Alloc> pending_fences;
+    Vec<VkSemaphore, Alloc> free_semaphores;
+    u64 created_fences = 0;
+    u64 created_semaphores = 0;
+
+    struct Fence_Signal {
+        VkSemaphore timeline = null;
+        u64 value = 0;
+    };
+
+    // Queue timeline values signaled by the last submission of each fence, keyed by handle.
+    Thread::Mutex fence_mutex;
+    Map<u64, Fence_Signal, Alloc> fence_signals;
+    VkSemaphore fence_timeline = null;
+    u64 fence_submitted = 0;
+
+    Thread::Mutex pipeline_cache_mutex;
+    Map<Thread::Id, VkPipelineCache, Alloc> pipeline_caches;
+    Vec<u8, Files::Alloc> pipeline_cache_data;
+    bool pipeline_cache_warm = false;
+    u64 pipelines_created = 0;
+    Profile::Time_Point pipeline_time = 0;
 };
 
 } // namespace impl
@@ -159,4 +293,8 @@ private:
 RPP_NAMED_ENUM(rvk::Queue_Family, "Queue_Family", graphics, RPP_CASE(graphics), RPP_CASE(present),
                RPP_CASE(compute), RPP_CASE(transfer));
 
-RPP_NAMED_ENUM(rvk::Heap, "Heap", device, RPP_CASE(device), RPP_CASE(host));
+RPP_NAMED_ENUM(rvk::Heap, "Heap", device, RPP_CASE(device), RPP_CASE(host), RPP_CASE(upload),
+               RPP_CASE(dynamic));
+
+RPP_NAMED_ENUM(rvk::Intent, "Intent", gpu_only, RPP_CASE(gpu_only), RPP_CASE(upload),
+               RPP_CASE(readback), RPP_CASE(dynamic));
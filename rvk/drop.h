@@ -7,6 +7,21 @@ namespace rvk {
 
 using namespace rpp;
 
+using Finalizer = FunctionN<16, void()>;
+
+// Dropped resources are destroyed once the current frame has completed. Typed drops are kept
+// in lock-free lists without a finalizer and destroyed within Config::deletion_budget_ms per
+// frame.
+void drop(Finalizer f);
+void drop(Buffer buffer);
+void drop(Image image);
+void drop(Image_View view);
+void drop(Descriptor_Set set);
+
+template<typename T>
+concept Typed_Drop =
+    Same<T, Buffer> || Same<T, Image> || Same<T, Image_View> || Same<T, Descriptor_Set>;
+
 template<typename T>
 struct Drop {
 
@@ -19,7 +34,11 @@ struct Drop {
     }
 
     ~Drop() {
-        drop([r = move(resource)]() {});
+        if constexpr(Typed_Drop<T>) {
+            drop(move(resource));
+        } else {
+            drop([r = move(resource)]() {});
+        }
     }
 
     Drop(const Drop&) = delete;
@@ -10,7 +10,6 @@ namespace rvk {
 
 namespace impl {
 Arc<Device, Alloc> get_device();
-bool validation_enabled();
 } // namespace impl
 
 using namespace rpp;
@@ -36,6 +35,21 @@ void write_set(Descriptor_Set& set, u32 frame_index, Binds&... binds) {
 template<typename F>
     requires Invocable<F, Commands&>
 auto sync(F&& f, Queue_Family family, u32 index) -> Invoke_Result<F, Commands&> {
+    // Inside a Batch_Scope, the work completes when the scope is flushed or closes.
+    if(auto scope = Batch_Scope::current()) {
+        auto cmds = make_commands(family);
+        if constexpr(Same<Invoke_Result<F, Commands&>, void>) {
+            f(cmds);
+            cmds.end();
+            scope->add(move(cmds), index);
+            return;
+        } else {
+            auto result = f(cmds);
+            cmds.end();
+            scope->add(move(cmds), index);
+            return result;
+        }
+    }
     auto fence = make_fence();
     auto cmds = make_commands(family);
     if constexpr(Same<Invoke_Result<F, Commands&>, void>) {
@@ -52,33 +66,96 @@ auto sync(F&& f, Queue_Family family, u32 index) -> Invoke_Result<F, Commands&>
     }
 }
 
+namespace impl {
 template<typename F>
-    requires Invocable<F, Commands&>
-auto async(Async::Pool<>& pool, F&& f, Queue_Family family, u32 index)
+auto async_submit(Async::Pool<>& pool, F&& f, Queue_Family family, u32 index)
     -> Async::Task<Invoke_Result<F, Commands&>> {
+    Async_Work work;
     auto fence = make_fence();
     auto cmds = make_commands(family);
     if constexpr(Same<Invoke_Result<F, Commands&>, void>) {
         forward<F>(f)(cmds);
         cmds.end();
         submit(cmds, index, fence);
-        if(impl::validation_enabled()) {
-            fence.wait();
-        } else {
-            co_await pool.event(fence.event());
-        }
+        co_await pool.event(fence.event());
         co_return;
     } else {
         auto ret = forward<F>(f)(cmds);
         cmds.end();
         submit(cmds, index, fence);
-        if(impl::validation_enabled()) {
-            fence.wait();
+        co_await pool.event(fence.event());
+        co_return ret;
+    }
+}
+
+Async::Task<void> await_batch(Async::Pool<>& pool, Async_Work work,
+                              Arc<Batch_State, Alloc> state, Queue_Family family, u64 value);
+
+template<typename R>
+Async::Task<R> await_batch(Async::Pool<>& pool, Async_Work work, Arc<Batch_State, Alloc> state,
+                           Queue_Family family, u64 value, R result) {
+    co_await await_batch(pool, move(work), move(state), family, value);
+    co_return result;
+}
+} // namespace impl
+
+// Inside a Batch_Scope, f records on the calling thread before async returns.
+template<typename F>
+    requires Invocable<F, Commands&>
+auto async(Async::Pool<>& pool, F&& f, Queue_Family family, u32 index)
+    -> Async::Task<Invoke_Result<F, Commands&>> {
+    if(auto scope = Batch_Scope::current()) {
+        impl::Async_Work work;
+        auto cmds = make_commands(family);
+        if constexpr(Same<Invoke_Result<F, Commands&>, void>) {
+            forward<F>(f)(cmds);
+            cmds.end();
+            u64 value = scope->add(move(cmds), index);
+            return impl::await_batch(pool, move(work), scope->state(), family, value);
         } else {
-            co_await pool.event(fence.event());
+            auto ret = forward<F>(f)(cmds);
+            cmds.end();
+            u64 value = scope->add(move(cmds), index);
+            return impl::await_batch(pool, move(work), scope->state(), family, value,
+                                     move(ret));
         }
-        co_return ret;
     }
+    return impl::async_submit(pool, forward<F>(f), family, index);
+}
+
+namespace impl {
+template<typename F>
+Async::Task<Commands> record_secondary(Async::Pool<>& pool, const Rendering_Formats& formats,
+                                       u64 i, F& f) {
+    // Secondaries come from the recording thread's pool.
+    co_await pool.suspend();
+    auto secondary = make_secondary(formats);
+    f(secondary, i);
+    secondary.end();
+    co_return secondary;
+}
+} // namespace impl
+
+template<typename F>
+    requires Invocable<F, Commands&, u64>
+auto render_parallel(Async::Pool<>& pool, Commands& cmds, VkRenderingInfo info,
+                     Rendering_Formats formats, u64 count, F f) -> Async::Task<void> {
+    Vec<Async::Task<Commands>, Alloc> tasks(count);
+    for(u64 i = 0; i < count; i++) {
+        tasks.push(impl::record_secondary(pool, formats, i, f));
+    }
+
+    info.flags |= VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+    vkCmdBeginRendering(cmds, &info);
+
+    Vec<Commands, Alloc> secondaries(count);
+    for(auto& task : tasks) {
+        secondaries.push(co_await task);
+    }
+    cmds.execute(move(secondaries));
+
+    vkCmdEndRendering(cmds);
+    co_return;
 }
 
 } // namespace rvk
@@ -34,6 +34,7 @@ using Alloc = Mallocator<"rvk">;
 
 enum class Queue_Family : u8;
 enum class Heap : u8;
+enum class Intent : u8;
 
 namespace impl {
 
@@ -43,8 +44,16 @@ struct Physical_Device;
 struct Device;
 struct Device_Memory;
 struct Image;
+struct Aliased_Memory;
 struct Image_View;
 struct Buffer;
+struct Transient;
+struct Buffer_Slice;
+struct Buffer_Pool;
+struct Relocation;
+struct Defragmenter;
+struct Uploader;
+struct Transient_Allocator;
 struct TLAS;
 struct BLAS;
 struct Descriptor_Set_Layout;
@@ -52,8 +61,14 @@ struct Descriptor_Set;
 struct Descriptor_Pool;
 struct Fence;
 struct Semaphore;
+struct Timeline;
+struct Timeline_Waiter;
 struct Sem_Ref;
+template<typename A>
+struct Barriers;
+struct Submit_Batch;
 struct Commands;
+struct Rendering_Formats;
 struct Command_Pool;
 template<Queue_Family F>
 struct Command_Pool_Manager;
@@ -65,6 +80,10 @@ struct Shader;
 struct Sampler;
 struct Swapchain;
 struct Compositor;
+struct Graph;
+struct Gpu_Profiler;
+struct Gpu_Timing;
+struct Event_Ring;
 struct Binder;
 struct Vk;
 
@@ -74,21 +93,30 @@ void check(VkResult result);
 
 } // namespace impl
 
+using impl::Barriers;
 using impl::Binding_Table;
 using impl::BLAS;
 using impl::Buffer;
+using impl::Buffer_Slice;
 using impl::Commands;
+using impl::Rendering_Formats;
 using impl::Descriptor_Set;
 using impl::Descriptor_Set_Layout;
 using impl::Fence;
+using impl::Gpu_Timing;
+using impl::Graph;
 using impl::Image;
 using impl::Image_View;
 using impl::Pipeline;
+using impl::Relocation;
 using impl::Push;
 using impl::Sampler;
 using impl::Sem_Ref;
 using impl::Semaphore;
+using impl::Submit_Batch;
+using impl::Timeline;
 using impl::Shader;
 using impl::TLAS;
+using impl::Transient;
 
 } // namespace rvk
@@ -0,0 +1,576 @@
+
+#include <imgui/imgui.h>
+
+#include "graph.h"
+#include "rvk.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+static constexpr u32 no_segment = 0xffffffff;
+static constexpr Graph::Pass no_pass = 0xffffffff;
+
+// Index of the family in the per-family state arrays.
+static u32 slot(Queue_Family family) {
+    return family == Queue_Family::compute ? 1 : 0;
+}
+
+static u32 later(u32 a, u32 b) {
+    if(a == no_segment) return b;
+    if(b == no_segment) return a;
+    return Math::max(a, b);
+}
+
+static u64 hash_access(u64 h, const Graph::Access& access) {
+    return rpp::hash(h, access.stage, access.access, static_cast<u32>(access.layout));
+}
+
+// The accesses a later access may have to synchronize with. Segments only increase within the
+// graph, and a semaphore signaled by a segment covers all earlier segments on its queue, so
+// each family only has to remember its latest segment.
+struct Graph::State {
+    VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    // Layout transitions count as writes without an access.
+    u32 write_segment = no_segment;
+    u32 write_family = 0;
+    VkPipelineStageFlags2 write_stage = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 write_access = VK_ACCESS_2_NONE;
+
+    // Accesses since the last write, which the next write must wait for. Writes to aliased
+    // memory are included, and their accesses must also be made available.
+    u32 read_segment[2] = {no_segment, no_segment};
+    VkPipelineStageFlags2 read_stage[2] = {};
+    VkAccessFlags2 read_access[2] = {};
+
+    // Stages and accesses on each family that the last write is already visible to.
+    VkPipelineStageFlags2 synced_stage[2] = {};
+    VkAccessFlags2 synced_access[2] = {};
+};
+
+Graph::Graph(Arc<Device, Alloc> D, Arc<Memory_Pool, Alloc> M, Timeline graphics_timeline,
+             Timeline compute_timeline, u32 frames_in_flight)
+    : device(move(D)), memory(move(M)), graphics_timeline(move(graphics_timeline)),
+      compute_timeline(move(compute_timeline)), frames_in_flight(frames_in_flight) {
+}
+
+Graph::~Graph() {
+    graphics_timeline.wait(graphics_value);
+    compute_timeline.wait(compute_value);
+    if(executions) {
+        info("[rvk] Executed graph % time(s) with % compile(s).", executions, compiles);
+    }
+}
+
+void Graph::imgui() {
+    using namespace ImGui;
+    Text("Passes: %lu | Segments: %lu | Barriers: %lu", passes.length(), segments.length(),
+         barriers.length());
+    Text("Transients: %lu | Memory: %lukb x %u", placements.length(), transient_size / 1024,
+         frames_in_flight);
+    Text("Compiles: %lu | Executions: %lu", compiles, executions);
+}
+
+void Graph::begin() {
+    resources.clear();
+    passes.clear();
+}
+
+Graph::Resource Graph::import(Image& image, VkImageAspectFlags aspect, Access before,
+                              Access after) {
+    resources.push(Resource_Info{
+        .kind = Kind::image,
+        .image = &image,
+        .aspect = aspect,
+        .extent = image.extent(),
+        .format = image.format(),
+        .before = before,
+        .after = after,
+    });
+    return static_cast<Resource>(resources.length() - 1);
+}
+
+Graph::Resource Graph::import(Buffer& buffer, Access before, Access after) {
+    resources.push(Resource_Info{
+        .kind = Kind::buffer,
+        .buffer = &buffer,
+        .before = before,
+        .after = after,
+    });
+    return static_cast<Resource>(resources.length() - 1);
+}
+
+Graph::Resource Graph::transient(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage,
+                                 VkImageAspectFlags aspect) {
+    resources.push(Resource_Info{
+        .kind = Kind::transient,
+        .aspect = aspect,
+        .extent = extent,
+        .format = format,
+        .usage = usage,
+    });
+    return static_cast<Resource>(resources.length() - 1);
+}
+
+Graph::Pass Graph::pass(String_View name, Queue_Family family, Record record) {
+    assert(family == Queue_Family::graphics || family == Queue_Family::compute);
+    passes.push(Pass_Info{
+        .name = name,
+        .family = family,
+        .record = move(record),
+    });
+    return static_cast<Pass>(passes.length() - 1);
+}
+
+void Graph::read(Pass pass, Resource resource, Access access) {
+    assert(pass < passes.length() && resource < resources.length());
+    // Accesses of one resource by a pass are merged, so it gets a single barrier.
+    for(auto& use : passes[pass].uses) {
+        if(use.resource == resource) {
+            assert(use.access.layout == access.layout);
+            use.access.stage |= access.stage;
+            use.access.access |= access.access;
+            return;
+        }
+    }
+    passes[pass].uses.push(Use{resource, access, false});
+}
+
+void Graph::write(Pass pass, Resource resource, Access access) {
+    read(pass, resource, access);
+    for(auto& use : passes[pass].uses) {
+        if(use.resource == resource) use.write = true;
+    }
+}
+
+Image& Graph::image(Resource resource) {
+    assert(resource < resources.length() && resources[resource].image);
+    return *resources[resource].image;
+}
+
+Buffer& Graph::buffer(Resource resource) {
+    assert(resource < resources.length() && resources[resource].buffer);
+    return *resources[resource].buffer;
+}
+
+u64 Graph::hash() const {
+    // Handles and callbacks may change every frame without changing the schedule.
+    u64 h = rpp::hash(resources.length(), passes.length());
+    for(auto& resource : resources) {
+        h = rpp::hash(h, static_cast<u8>(resource.kind), resource.aspect, resource.extent.width,
+                      resource.extent.height, resource.extent.depth,
+                      static_cast<u32>(resource.format), resource.usage);
+        h = hash_access(hash_access(h, resource.before), resource.after);
+    }
+    for(auto& pass : passes) {
+        h = rpp::hash(h, static_cast<u8>(pass.family), pass.uses.length());
+        for(auto& use : pass.uses) {
+            h = hash_access(rpp::hash(h, use.resource, use.write), use.access);
+        }
+    }
+    return h;
+}
+
+void Graph::execute() {
+
+    u64 h = hash();
+    if(segments.empty() || h != compiled_hash) {
+        compile();
+        make_transients();
+        compiled_hash = h;
+        compiles++;
+    }
+
+    if(!transient_sets.empty()) {
+        Transient_Set& set = *transient_sets[rvk::frame()];
+        for(u64 i = 0; i < placements.length(); i++) {
+            resources[placements[i].resource].image = &set.images[i];
+        }
+    }
+
+    bool used_compute = false;
+
+    Region(R) {
+        Vec<u64, Mregion<R>> values(segments.length());
+        Vec<Commands, Mregion<R>> commands(segments.length());
+        Vec<Sem_Ref, Mregion<R>> waits(2);
+
+        for(auto& segment : segments) {
+            if(segment.empty) {
+                values.push(0);
+                continue;
+            }
+
+            auto cmds = make_frame_commands(segment.family);
+            for(u32 i = 0; i < segment.step_count; i++) {
+                Step& step = steps[segment.step_offset + i];
+                record_barriers(cmds, Slice<const Barrier>{barriers.data() + step.barrier_offset,
+                                                           step.barrier_count});
+                if(step.pass != no_pass) passes[step.pass].record(cmds);
+            }
+            cmds.end();
+
+            bool compute = segment.family == Queue_Family::compute;
+            used_compute |= compute;
+            Timeline& timeline = compute ? compute_timeline : graphics_timeline;
+            u64 value = compute ? ++compute_value : ++graphics_value;
+            values.push(value);
+
+            waits.clear();
+            for(auto& wait : segment.waits) {
+                Timeline& source = segments[wait.segment].family == Queue_Family::compute
+                                       ? compute_timeline
+                                       : graphics_timeline;
+                waits.push(Sem_Ref{source, values[wait.segment], wait.stage});
+            }
+            Sem_Ref signal{timeline, value, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT};
+
+            batch.add(cmds, 0, waits.slice(), Slice{signal});
+            commands.push(move(cmds));
+        }
+
+        rvk::submit(batch);
+    }
+
+    // Frame resources, including the transients of this slot, are reused once the frame
+    // completes, so it waits for both queues.
+    wait_frame(Sem_Ref{graphics_timeline, graphics_value, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT});
+    if(used_compute) {
+        wait_frame(
+            Sem_Ref{compute_timeline, compute_value, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT});
+    }
+
+    executions++;
+}
+
+void Graph::compile() {
+
+    segments.clear();
+    steps.clear();
+    barriers.clear();
+
+    place_transients();
+
+    Region(R) {
+        Vec<State, Mregion<R>> states(resources.length());
+        for(auto& resource : resources) {
+            State state;
+            if(resource.kind != Kind::transient) {
+                state.layout = resource.before.layout;
+                if(resource.before.stage != VK_PIPELINE_STAGE_2_NONE) {
+                    state.write_segment = 0;
+                    state.write_stage = resource.before.stage;
+                    state.write_access = resource.before.access;
+                }
+            }
+            states.push(state);
+        }
+
+        segments.push(Segment{});
+
+        for(Pass p = 0; p < passes.length(); p++) {
+            Pass_Info& pass = passes[p];
+
+            if(segments.length() == 1 || segments.back().family != pass.family) {
+                segments.push(Segment{
+                    .family = pass.family,
+                    .step_offset = static_cast<u32>(steps.length()),
+                });
+            }
+            u32 segment = static_cast<u32>(segments.length() - 1);
+
+            Step step{p, static_cast<u32>(barriers.length()), 0};
+
+            for(auto& use : pass.uses) {
+                Resource_Info& resource = resources[use.resource];
+                assert(resource.kind == Kind::buffer ||
+                       use.access.layout != VK_IMAGE_LAYOUT_UNDEFINED);
+
+                // A transient's memory was last used by the transients it aliases, so its first
+                // access waits for all of their accesses.
+                if(resource.kind == Kind::transient) {
+                    for(auto& placement : placements) {
+                        if(placement.resource != use.resource || placement.first != p) continue;
+                        State& state = states[use.resource];
+                        u64 end = placement.offset + placement.size;
+                        for(auto& other : placements) {
+                            if(other.last >= p || other.offset >= end ||
+                               placement.offset >= other.offset + other.size) {
+                                continue;
+                            }
+                            State& prior = states[other.resource];
+                            for(u32 f = 0; f < 2; f++) {
+                                state.read_segment[f] =
+                                    later(state.read_segment[f], prior.read_segment[f]);
+                                state.read_stage[f] |= prior.read_stage[f];
+                                state.read_access[f] |= prior.read_access[f];
+                            }
+                            if(prior.write_segment != no_segment) {
+                                u32 f = prior.write_family;
+                                state.read_segment[f] =
+                                    later(state.read_segment[f], prior.write_segment);
+                                state.read_stage[f] |= prior.write_stage;
+                                state.read_access[f] |= prior.write_access;
+                            }
+                        }
+                    }
+                }
+
+                track(states.slice(), use.resource, use.access, use.write, segment);
+            }
+
+            step.barrier_count = static_cast<u32>(barriers.length()) - step.barrier_offset;
+            steps.push(step);
+            segments.back().step_count++;
+        }
+
+        // The tail leaves imported resources in their after states.
+        segments.push(Segment{
+            .family = Queue_Family::graphics,
+            .step_offset = static_cast<u32>(steps.length()),
+            .step_count = 1,
+        });
+        u32 tail = static_cast<u32>(segments.length() - 1);
+        Step step{no_pass, static_cast<u32>(barriers.length()), 0};
+
+        for(Resource r = 0; r < resources.length(); r++) {
+            Resource_Info& resource = resources[r];
+            if(resource.kind == Kind::transient) continue;
+
+            State& state = states[r];
+            Access after = resource.after;
+            if(after.layout == VK_IMAGE_LAYOUT_UNDEFINED) after.layout = state.layout;
+
+            // Work after the graph may use the resource on the graphics queue, so accesses on
+            // the compute queue must be waited for even without an after state.
+            if(after.stage == VK_PIPELINE_STAGE_2_NONE) {
+                bool compute = (state.write_segment != no_segment && state.write_family == 1) ||
+                               state.read_segment[1] != no_segment;
+                if(!compute && after.layout == state.layout) continue;
+                after.stage = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT;
+            }
+            track(states.slice(), r, after, true, tail);
+        }
+
+        step.barrier_count = static_cast<u32>(barriers.length()) - step.barrier_offset;
+        steps.push(step);
+        segments[tail].empty = step.barrier_count == 0 && segments[tail].waits.empty();
+    }
+
+    bool head_used = false;
+    for(auto& segment : segments) {
+        for(auto& wait : segment.waits) {
+            head_used |= wait.segment == 0;
+        }
+    }
+    segments[0].empty = !head_used;
+}
+
+void Graph::track(Slice<State> states, Resource resource, Access access, bool write,
+                  u32 segment) {
+
+    State& state = states[resource];
+    u32 family = slot(segments[segment].family);
+
+    bool transition = resources[resource].kind != Kind::buffer && access.layout != state.layout;
+    bool exclusive = write || transition;
+
+    VkPipelineStageFlags2 src_stage = VK_PIPELINE_STAGE_2_NONE;
+    VkAccessFlags2 src_access = VK_ACCESS_2_NONE;
+    bool barrier = transition;
+
+    // Same queue dependencies are barriers. Other queues are waited for with a semaphore,
+    // which also makes their writes visible; a transition still needs a barrier, whose source
+    // stage is chained to the semaphore wait.
+    auto depend = [&](u32 source, u32 source_family, VkPipelineStageFlags2 stage,
+                      VkAccessFlags2 access_mask) {
+        if(source == no_segment) return;
+        if(source_family == family) {
+            src_stage |= stage;
+            src_access |= access_mask;
+            barrier = true;
+        } else {
+            wait(segment, source, access.stage);
+            src_stage |= access.stage;
+        }
+    };
+
+    if(state.write_segment != no_segment) {
+        bool synced = (access.stage & ~state.synced_stage[family]) == 0 &&
+                      (access.access & ~state.synced_access[family]) == 0;
+        if(exclusive || !synced) {
+            depend(state.write_segment, state.write_family, state.write_stage,
+                   state.write_access);
+        }
+    }
+    if(exclusive) {
+        for(u32 f = 0; f < 2; f++) {
+            depend(state.read_segment[f], f, state.read_stage[f], state.read_access[f]);
+        }
+    }
+
+    if(barrier) {
+        barriers.push(Barrier{
+            .resource = resource,
+            .src = {src_stage, src_access, state.layout},
+            .dst = access,
+        });
+    }
+
+    if(exclusive) {
+        state.write_segment = segment;
+        state.write_family = family;
+        state.write_stage = access.stage;
+        state.write_access = write ? access.access : VK_ACCESS_2_NONE;
+        for(u32 f = 0; f < 2; f++) {
+            state.read_segment[f] = no_segment;
+            state.read_stage[f] = VK_PIPELINE_STAGE_2_NONE;
+            state.read_access[f] = VK_ACCESS_2_NONE;
+            state.synced_stage[f] = VK_PIPELINE_STAGE_2_NONE;
+            state.synced_access[f] = VK_ACCESS_2_NONE;
+        }
+    }
+    if(!write) {
+        state.read_segment[family] = segment;
+        state.read_stage[family] |= access.stage;
+        state.synced_stage[family] |= access.stage;
+        state.synced_access[family] |= access.access;
+    }
+    state.layout = access.layout;
+}
+
+void Graph::wait(u32 segment, u32 source, VkPipelineStageFlags2 stage) {
+    Queue_Family family = segments[source].family;
+    for(auto& wait : segments[segment].waits) {
+        if(segments[wait.segment].family == family) {
+            wait.segment = Math::max(wait.segment, source);
+            wait.stage |= stage;
+            return;
+        }
+    }
+    segments[segment].waits.push(Wait{source, stage});
+}
+
+void Graph::place_transients() {
+
+    placements.clear();
+    transient_size = 0;
+    transient_alignment = 1;
+
+    for(Resource r = 0; r < resources.length(); r++) {
+        Resource_Info& resource = resources[r];
+        if(resource.kind != Kind::transient) continue;
+
+        Pass first = no_pass, last = 0;
+        for(Pass p = 0; p < passes.length(); p++) {
+            for(auto& use : passes[p].uses) {
+                if(use.resource != r) continue;
+                first = Math::min(first, p);
+                last = Math::max(last, p);
+            }
+        }
+        if(first == no_pass) continue;
+
+        VkMemoryRequirements requirements =
+            memory->requirements(resource.extent, resource.format, resource.usage);
+        placements.push(Placement{
+            .resource = r,
+            .size = requirements.size,
+            .alignment = requirements.alignment,
+            .first = first,
+            .last = last,
+        });
+    }
+
+    // Larger images are placed first, each at the lowest offset that does not overlap an
+    // image used at the same time.
+    Region(R) {
+        Vec<u64, Mregion<R>> order(placements.length());
+        for(u64 i = 0; i < placements.length(); i++) {
+            u64 j = order.length();
+            order.push(i);
+            for(; j > 0 && placements[order[j - 1]].size < placements[i].size; j--) {
+                order[j] = order[j - 1];
+            }
+            order[j] = i;
+        }
+
+        for(u64 i = 0; i < order.length(); i++) {
+            Placement& placement = placements[order[i]];
+            u64 offset = 0;
+            for(bool moved = true; moved;) {
+                moved = false;
+                for(u64 j = 0; j < i; j++) {
+                    Placement& other = placements[order[j]];
+                    if(other.last < placement.first || placement.last < other.first) continue;
+                    if(other.offset >= offset + placement.size ||
+                       offset >= other.offset + other.size) {
+                        continue;
+                    }
+                    u64 end = other.offset + other.size;
+                    offset = (end + placement.alignment - 1) & ~(placement.alignment - 1);
+                    moved = true;
+                }
+            }
+            placement.offset = offset;
+            transient_size = Math::max(transient_size, offset + placement.size);
+            transient_alignment = Math::max(transient_alignment, placement.alignment);
+        }
+    }
+}
+
+void Graph::make_transients() {
+
+    // Frames in flight may still use the previous images.
+    for(auto& set : transient_sets) {
+        drop([set = move(set)]() {});
+    }
+    transient_sets.clear();
+
+    if(placements.empty()) return;
+
+    for(u32 i = 0; i < frames_in_flight; i++) {
+        auto aliased = memory->make_aliased(transient_size, transient_alignment);
+        if(!aliased.ok()) {
+            die("[rvk] Failed to allocate %mb of transient graph memory.",
+                transient_size / Math::MB(1));
+        }
+        Vec<Image, Alloc> images(placements.length());
+        for(auto& placement : placements) {
+            Resource_Info& resource = resources[placement.resource];
+            images.push(aliased->make(placement.offset, resource.extent, resource.format,
+                                      resource.usage));
+        }
+        transient_sets.push(
+            Arc<Transient_Set, Alloc>::make(Transient_Set{move(*aliased), move(images)}));
+    }
+}
+
+void Graph::record_barriers(Commands& cmds, Slice<const Barrier> list) {
+
+    Region(R) {
+        Barriers<Mregion<R>> dependency;
+        for(auto& barrier : list) {
+            Resource_Info& resource = resources[barrier.resource];
+            if(resource.kind == Kind::buffer) {
+                dependency.buffer(*resource.buffer, barrier.src.stage, barrier.dst.stage,
+                                  barrier.src.access, barrier.dst.access);
+                continue;
+            }
+            dependency.image(*resource.image,
+                             VkImageSubresourceRange{
+                                 .aspectMask = resource.aspect,
+                                 .baseMipLevel = 0,
+                                 .levelCount = VK_REMAINING_MIP_LEVELS,
+                                 .baseArrayLayer = 0,
+                                 .layerCount = VK_REMAINING_ARRAY_LAYERS,
+                             },
+                             barrier.src.layout, barrier.dst.layout, barrier.src.stage,
+                             barrier.dst.stage, barrier.src.access, barrier.dst.access);
+        }
+        dependency.flush(cmds);
+    }
+}
+
+} // namespace rvk::impl
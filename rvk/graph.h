@@ -0,0 +1,184 @@
+
+#pragma once
+
+#include <rpp/base.h>
+
+#include "fwd.h"
+
+#include "commands.h"
+#include "memory.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+// An optional layer that derives barriers from declared resource accesses. Each frame, passes
+// are declared in execution order with the images and buffers they read and write, then
+// execute() records and submits them. Consecutive passes on the same queue share a command
+// buffer, all barriers before a pass are batched into one dependency, and passes on the compute
+// queue are ordered against graphics passes with timeline semaphores.
+//
+// Transient images only live within the graph. Those whose uses never overlap share memory,
+// with one set per frame in flight. When the declarations match the previous frame, the
+// schedule and transient images are reused, so only the pass callbacks run. Destroying the
+// graph waits for its submitted passes.
+struct Graph {
+
+    using Resource = u32;
+    using Pass = u32;
+    using Record = Function<void(Commands&)>;
+
+    struct Access {
+        VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_NONE;
+        VkAccessFlags2 access = VK_ACCESS_2_NONE;
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+    };
+
+    ~Graph();
+
+    Graph(const Graph&) = delete;
+    Graph& operator=(const Graph&) = delete;
+    Graph(Graph&&) = delete;
+    Graph& operator=(Graph&&) = delete;
+
+    void imgui();
+
+    // Clears the previous frame's declarations.
+    void begin();
+
+    // Imported resources were last accessed as described by before, by work submitted to the
+    // graphics queue before execute(), and are left as described by after. An after layout of
+    // VK_IMAGE_LAYOUT_UNDEFINED keeps the layout of the last pass. Graph barriers bypass the
+    // images' tracked states, so imported images should be transitioned explicitly afterwards.
+    Resource import(Image& image, VkImageAspectFlags aspect, Access before, Access after);
+    Resource import(Buffer& buffer, Access before, Access after);
+    Resource transient(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage,
+                       VkImageAspectFlags aspect);
+
+    // Passes run on the graphics or compute queue, in declaration order on each queue.
+    Pass pass(String_View name, Queue_Family family, Record record);
+    void read(Pass pass, Resource resource, Access access);
+    void write(Pass pass, Resource resource, Access access);
+
+    // Valid while passes are recorded.
+    Image& image(Resource resource);
+    Buffer& buffer(Resource resource);
+
+    // Records and submits the passes, and makes the current frame wait for them. Imported
+    // resources must not be accessed by other work until the frame completes, except through
+    // the graphics queue after this call.
+    void execute();
+
+private:
+    explicit Graph(Arc<Device, Alloc> device, Arc<Memory_Pool, Alloc> memory,
+                   Timeline graphics_timeline, Timeline compute_timeline, u32 frames_in_flight);
+    friend struct Box<Graph, Alloc>;
+
+    enum class Kind : u8 { image, buffer, transient };
+
+    struct Resource_Info {
+        Kind kind = Kind::image;
+        Image* image = null;
+        Buffer* buffer = null;
+        VkImageAspectFlags aspect = 0;
+        VkExtent3D extent = {};
+        VkFormat format = VK_FORMAT_UNDEFINED;
+        VkImageUsageFlags usage = 0;
+        Access before;
+        Access after;
+    };
+
+    struct Use {
+        Resource resource = 0;
+        Access access;
+        bool write = false;
+    };
+
+    struct Pass_Info {
+        String_View name;
+        Queue_Family family = Queue_Family::graphics;
+        Record record;
+        Vec<Use, Alloc> uses;
+    };
+
+    // The compiled schedule refers to resources by index, so it stays valid when imported
+    // handles change between frames.
+    struct Barrier {
+        Resource resource = 0;
+        Access src;
+        Access dst;
+    };
+
+    struct Wait {
+        u32 segment = 0;
+        VkPipelineStageFlags2 stage = VK_PIPELINE_STAGE_2_NONE;
+    };
+
+    struct Step {
+        Pass pass = 0;
+        u32 barrier_offset = 0;
+        u32 barrier_count = 0;
+    };
+
+    // Consecutive passes on one queue, submitted as one command buffer. The first segment
+    // stands for work submitted before the graph, and the last one holds the barriers to the
+    // after states; both are only submitted when needed.
+    struct Segment {
+        Queue_Family family = Queue_Family::graphics;
+        u32 step_offset = 0;
+        u32 step_count = 0;
+        Vec<Wait, Alloc> waits;
+        bool empty = false;
+    };
+
+    struct Placement {
+        Resource resource = 0;
+        u64 offset = 0;
+        u64 size = 0;
+        u64 alignment = 0;
+        Pass first = 0;
+        Pass last = 0;
+    };
+
+    struct Transient_Set {
+        Aliased_Memory memory;
+        Vec<Image, Alloc> images;
+    };
+
+    struct State;
+
+    u64 hash() const;
+    void compile();
+    void track(Slice<State> states, Resource resource, Access access, bool write, u32 segment);
+    void wait(u32 segment, u32 source, VkPipelineStageFlags2 stage);
+    void place_transients();
+    void make_transients();
+    void record_barriers(Commands& cmds, Slice<const Barrier> barriers);
+
+    Arc<Device, Alloc> device;
+    Arc<Memory_Pool, Alloc> memory;
+    Timeline graphics_timeline;
+    Timeline compute_timeline;
+    u64 graphics_value = 0;
+    u64 compute_value = 0;
+    u32 frames_in_flight = 0;
+
+    Vec<Resource_Info, Alloc> resources;
+    Vec<Pass_Info, Alloc> passes;
+
+    u64 compiled_hash = 0;
+    Vec<Segment, Alloc> segments;
+    Vec<Step, Alloc> steps;
+    Vec<Barrier, Alloc> barriers;
+    Submit_Batch batch;
+
+    Vec<Placement, Alloc> placements;
+    u64 transient_size = 0;
+    u64 transient_alignment = 1;
+    Vec<Arc<Transient_Set, Alloc>, Alloc> transient_sets;
+
+    u64 compiles = 0;
+    u64 executions = 0;
+};
+
+} // namespace rvk::impl
@@ -8,14 +8,55 @@ namespace rvk::impl {
 
 using namespace rpp;
 
+static Thread::Atomic next_memory_id{1};
+
+static Thread::Mutex thread_cache_mutex;
+static Thread::Atomic cache_epoch;
+
+// Accesses that write image memory.
+static constexpr VkAccessFlags2 write_accesses =
+    VK_ACCESS_2_SHADER_WRITE_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT |
+    VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+    VK_ACCESS_2_TRANSFER_WRITE_BIT | VK_ACCESS_2_HOST_WRITE_BIT | VK_ACCESS_2_MEMORY_WRITE_BIT;
+
+static u64 next_pow2(u64 x) {
+    u64 result = 1;
+    while(result < x) result <<= 1;
+    return result;
+}
+
+static VkImageCreateInfo image_info(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage,
+                                    const Array<u32, 3>& indices) {
+    return VkImageCreateInfo{
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext = null,
+        .flags = 0,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format,
+        .extent = extent,
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_CONCURRENT,
+        .queueFamilyIndexCount = static_cast<u32>(indices.length()),
+        .pQueueFamilyIndices = indices.data(),
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+}
+
 Device_Memory::Device_Memory(Arc<Physical_Device, Alloc>& physical_device, Arc<Device, Alloc> D,
-                             Heap location, u64 heap_size)
-    : device(move(D)), location(location), allocator(heap_size) {
+                             Heap location, u64 heap_size, u64 cache_limit,
+                             u64 dedicated_threshold)
+    : device(move(D)), location(location), dedicated_threshold(dedicated_threshold),
+      allocator(heap_size) {
 
     VkMemoryAllocateFlagsInfo flags = {
         .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
-        .flags = location == Heap::device ? VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT
-                                          : VkMemoryAllocateFlags{},
+        .flags = addressable()
+                     ? static_cast<VkMemoryAllocateFlags>(VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT)
+                     : VkMemoryAllocateFlags{},
     };
 
     VkMemoryAllocateInfo info = {
@@ -32,7 +73,13 @@ Device_Memory::Device_Memory(Arc<Physical_Device, Alloc>& physical_device, Arc<D
     buffer_image_granularity =
         physical_device->properties().device.properties.limits.bufferImageGranularity;
 
-    if(location == Heap::host) {
+    id = next_memory_id.incr();
+    cache_base = Math::max(min_cache_class, next_pow2(buffer_image_granularity));
+    while(cache_classes < max_cache_classes && (cache_base << cache_classes) <= cache_limit) {
+        cache_classes++;
+    }
+
+    if(location != Heap::device) {
         RVK_CHECK(vkMapMemory(*device, device_memory, 0, VK_WHOLE_SIZE, 0,
                               reinterpret_cast<void**>(&persistent_map)));
     }
@@ -41,12 +88,22 @@ Device_Memory::Device_Memory(Arc<Physical_Device, Alloc>& physical_device, Arc<D
 }
 
 Device_Memory::~Device_Memory() {
+    {
+        Thread::Lock lock{thread_cache_mutex};
+        for(Thread_Cache* cache : thread_caches) {
+            flush(*cache);
+            cache->memory = null;
+        }
+        if(!thread_caches.empty()) cache_epoch.incr();
+        thread_caches.clear();
+    }
     if(persistent_map) {
         vkUnmapMemory(*device, device_memory);
     }
     if(device_memory) {
         vkFreeMemory(*device, device_memory, null);
         allocator.statistics().assert_clear();
+        assert(dedicated_count == 0);
         info("[rvk] Freed % heap.", location);
     }
     persistent_map = null;
@@ -60,43 +117,348 @@ void Device_Memory::imgui() {
          stat.free_size / Math::MB(1), stat.high_water / Math::MB(1));
     Text("Alloc Blocks: %lu | Free Blocks: %lu", stat.allocated_blocks, stat.free_blocks);
     Text("Capacity: %lumb", stat.total_capacity / Math::MB(1));
+
+    u64 threads = 0, cached = 0, dedicated = 0, dedicated_blocks = 0;
+    {
+        Thread::Lock lock{thread_cache_mutex};
+        threads = thread_caches.length();
+    }
+    {
+        Thread::Lock lock{mutex};
+        cached = cached_size;
+        dedicated = dedicated_size;
+        dedicated_blocks = dedicated_count;
+    }
+    Text("Thread Caches: %lu | Cached: %lukb | Classes: %lu", threads, cached / 1024,
+         cache_classes);
+    Text("Dedicated: %lumb in %lu allocation(s)", dedicated / Math::MB(1), dedicated_blocks);
 }
 
 typename Heap_Allocator::Stats Device_Memory::stats() {
+    Thread::Lock lock{mutex};
     return allocator.statistics();
 }
 
-void Device_Memory::release(Heap_Allocator::Range address) {
-    assert(address);
-    allocator.free(address);
+u64 Device_Memory::size() {
+    Thread::Lock lock{mutex};
+    return allocator.statistics().total_capacity;
 }
 
-Opt<Image> Device_Memory::make(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage) {
+bool Device_Memory::empty() {
+    Thread::Lock lock{mutex};
+    return unused();
+}
 
-    VkImage image = null;
+bool Device_Memory::close() {
+    Thread::Lock lock{mutex};
+    closed.store(1);
+    if(unused()) return true;
+    closed.store(0);
+    return false;
+}
+
+bool Device_Memory::unused() {
+    // Ranges parked in thread caches are returned when the heap is destroyed, but ranges taken
+    // from them are still live.
+    return allocator.statistics().allocated_size == cached_size && live_cached.load() == 0 &&
+           dedicated_count == 0;
+}
+
+Memory_Pool::Memory_Pool(Arc<Physical_Device, Alloc> P, Arc<Device, Alloc> D, Config config)
+    : physical_device(move(P)), device(move(D)), config(config) {
+    if(!grow(0).ok()) {
+        die("[rvk] Failed to allocate initial % heap block of size %mb.", config.location,
+            config.block_size / Math::MB(1));
+    }
+}
+
+void Memory_Pool::imgui() {
+    using namespace ImGui;
+
+    u64 freed = 0, total = 0;
+    {
+        Thread::Lock lock{mutex};
+        freed = freed_blocks;
+        total = reserved;
+    }
+    auto stat = device->heap_stat(config.location);
+    Text("Reserved: %lumb / %lumb | Freed blocks: %lu", total / Math::MB(1),
+         config.limit / Math::MB(1), freed);
+    Text("Driver usage: %lumb | Budget: %lumb", stat.first / Math::MB(1),
+         stat.second / Math::MB(1));
+
+    i32 i = 0;
+    for(auto& memory : blocks()) {
+        PushID(i++);
+        if(TreeNodeEx("##block", ImGuiTreeNodeFlags_DefaultOpen, "[%d]", i)) {
+            memory->imgui();
+            TreePop();
+        }
+        PopID();
+    }
+}
+
+Vec<Arc<Device_Memory, Alloc>, Alloc> Memory_Pool::blocks() {
+    Thread::Lock lock{mutex};
+    Vec<Arc<Device_Memory, Alloc>, Alloc> result(blocks_.length());
+    for(auto& block : blocks_) {
+        result.push(block.memory.dup());
+    }
+    return result;
+}
+
+Opt<Buffer> Memory_Pool::make(u64 size, VkBufferUsageFlags usage) {
+    return make<Buffer>(size, [&](Arc<Device_Memory, Alloc>& memory) {
+        return memory->make(size, usage);
+    });
+}
+
+Opt<Image> Memory_Pool::make(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage) {
+    // Images larger than the dedicated threshold do not need room in the block.
+    return make<Image>(0, [&](Arc<Device_Memory, Alloc>& memory) {
+        return memory->make(extent, format, usage);
+    });
+}
+
+Opt<Aliased_Memory> Memory_Pool::make_aliased(u64 size, u64 alignment) {
+    return make<Aliased_Memory>(size, [&](Arc<Device_Memory, Alloc>& memory) {
+        return memory->make_aliased(size, alignment);
+    });
+}
+
+VkMemoryRequirements Memory_Pool::requirements(VkExtent3D extent, VkFormat format,
+                                               VkImageUsageFlags usage) {
 
     Array<u32, 3> indices{device->queue_index(Queue_Family::graphics),
                           device->queue_index(Queue_Family::compute),
                           device->queue_index(Queue_Family::transfer)};
 
-    VkImageCreateInfo info = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .pNext = null,
-        .flags = 0,
-        .imageType = VK_IMAGE_TYPE_2D,
-        .format = format,
-        .extent = extent,
-        .mipLevels = 1,
-        .arrayLayers = 1,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_CONCURRENT,
-        .queueFamilyIndexCount = static_cast<u32>(indices.length()),
-        .pQueueFamilyIndices = indices.data(),
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    VkImageCreateInfo info = image_info(extent, format, usage, indices);
+
+    VkDeviceImageMemoryRequirements image_requirements = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+        .pCreateInfo = &info,
     };
 
+    VkMemoryRequirements2 memory_requirements = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+    };
+
+    vkGetDeviceImageMemoryRequirements(*device, &image_requirements, &memory_requirements);
+    return memory_requirements.memoryRequirements;
+}
+
+Opt<Arc<Device_Memory, Alloc>> Memory_Pool::grow(u64 size) {
+    Thread::Lock lock{mutex};
+
+    // Leave room for alignment, and avoid adding a block per oversized request.
+    u64 block_size = Math::max(config.block_size, 2 * size);
+    block_size = Math::min(block_size, physical_device->max_allocation());
+
+    if(reserved + block_size > config.limit) {
+        block_size = config.limit - Math::min(reserved, config.limit);
+    }
+
+    auto stat = device->heap_stat(config.location);
+    u64 available = stat.second > stat.first ? stat.second - stat.first : 0;
+    if(block_size > available) {
+        warn("[rvk] % heap block of %mb exceeds the memory budget (%mb available).",
+             config.location, block_size / Math::MB(1), available / Math::MB(1));
+        block_size = available;
+    }
+
+    if(block_size == 0 || block_size < size) {
+        warn("[rvk] % heap is full: %mb reserved, limit %mb.", config.location,
+             reserved / Math::MB(1), config.limit / Math::MB(1));
+        return {};
+    }
+
+    auto memory =
+        Arc<Device_Memory, Alloc>::make(physical_device, device.dup(), config.location, block_size,
+                                        config.cache_limit, config.dedicated_threshold);
+    reserved += block_size;
+    blocks_.push(Block{memory.dup()});
+    return Opt{move(memory)};
+}
+
+void Memory_Pool::trim() {
+    Thread::Lock lock{mutex};
+
+    Vec<Block, Alloc> kept(blocks_.length());
+    for(u64 i = 0; i < blocks_.length(); i++) {
+        Block& block = blocks_[i];
+        if(i > 0 && block.memory->empty()) {
+            // Allocating from a snapshot of the blocks races with the check above, so the
+            // block is only removed if it is still empty once closed.
+            if(++block.empty_frames > config.trim_frames && block.memory->close()) {
+                reserved -= block.memory->size();
+                freed_blocks++;
+                continue;
+            }
+        } else {
+            block.empty_frames = 0;
+        }
+        kept.push(move(block));
+    }
+    blocks_ = move(kept);
+}
+
+Opt<u64> Device_Memory::cache_class(u64 size) {
+    for(u64 c = 0; c < cache_classes; c++) {
+        if(size <= cache_base << c) return Opt{c};
+    }
+    return {};
+}
+
+Device_Memory::Thread_Cache& Device_Memory::thread_cache() {
+    if(i64 epoch = cache_epoch.load(); epoch != this_thread.epoch) {
+        this_thread.prune();
+        this_thread.epoch = epoch;
+    }
+
+    for(auto& cache : this_thread.caches) {
+        if(cache->memory_id == id) return *cache;
+    }
+
+    this_thread.caches.push(Box<Thread_Cache, Alloc>::make());
+
+    Thread_Cache& cache = *this_thread.caches.back();
+    cache.memory_id = id;
+    cache.memory = this;
+
+    Thread::Lock lock{thread_cache_mutex};
+    thread_caches.push(&cache);
+    return cache;
+}
+
+void Device_Memory::flush(Thread_Cache& cache) {
+    Thread::Lock lock{mutex};
+    for(u64 c = 0; c < cache_classes; c++) {
+        for(auto& address : cache.magazines[c]) {
+            allocator.free(address);
+        }
+        cached_size -= cache.magazines[c].length() * (cache_base << c);
+        cache.magazines[c].clear();
+    }
+}
+
+Device_Memory::This_Thread::~This_Thread() {
+    Thread::Lock lock{thread_cache_mutex};
+    for(auto& cache : caches) {
+        Device_Memory* memory = cache->memory;
+        if(!memory) continue;
+
+        memory->flush(*cache);
+
+        auto& registered = memory->thread_caches;
+        for(u64 i = 0; i < registered.length(); i++) {
+            if(registered[i] == &*cache) {
+                registered[i] = registered.back();
+                registered.pop();
+                break;
+            }
+        }
+    }
+    caches.clear();
+}
+
+void Device_Memory::This_Thread::prune() {
+    Thread::Lock lock{thread_cache_mutex};
+    for(u64 i = 0; i < caches.length();) {
+        if(caches[i]->memory) {
+            i++;
+            continue;
+        }
+        if(i + 1 < caches.length()) caches[i] = move(caches.back());
+        caches.pop();
+    }
+}
+
+Opt<Heap_Allocator::Range> Device_Memory::allocate(u64 size, u64 alignment) {
+
+    alignment = Math::max(alignment, buffer_image_granularity);
+
+    auto c = cache_class(size);
+    if(!c.ok()) {
+        Thread::Lock lock{mutex};
+        if(closed.load()) return {};
+        return allocator.allocate(size, alignment);
+    }
+
+    u64 class_size = cache_base << *c;
+
+    // Blocks in the cache are aligned to their size, so stricter requests go to the shared
+    // allocator directly. The result is still a whole block, so it can be cached on release.
+    if(alignment > class_size) {
+        Thread::Lock lock{mutex};
+        if(closed.load()) return {};
+        auto address = allocator.allocate(class_size, alignment);
+        if(address.ok()) {
+            cached_size += class_size;
+            live_cached.incr();
+        }
+        return address;
+    }
+
+    auto& magazine = thread_cache().magazines[*c];
+
+    if(magazine.empty()) {
+        Thread::Lock lock{mutex};
+        if(closed.load()) return {};
+        for(u64 i = 0; i < cache_batch; i++) {
+            auto address = allocator.allocate(class_size, class_size);
+            if(!address.ok()) break;
+            magazine.push(*address);
+            cached_size += class_size;
+        }
+        if(magazine.empty()) return {};
+    }
+
+    live_cached.incr();
+    if(closed.load()) {
+        live_cached.decr();
+        return {};
+    }
+
+    Heap_Allocator::Range address = magazine.back();
+    magazine.pop();
+    return Opt{address};
+}
+
+void Device_Memory::release(Heap_Allocator::Range address, u64 size) {
+    assert(address);
+
+    auto c = cache_class(size);
+    if(!c.ok()) {
+        Thread::Lock lock{mutex};
+        allocator.free(address);
+        return;
+    }
+
+    auto& magazine = thread_cache().magazines[*c];
+    magazine.push(address);
+    live_cached.decr();
+
+    if(magazine.length() >= 2 * cache_batch) {
+        Thread::Lock lock{mutex};
+        for(u64 i = 0; i < cache_batch; i++) {
+            allocator.free(magazine.back());
+            magazine.pop();
+        }
+        cached_size -= cache_batch * (cache_base << *c);
+    }
+}
+
+VkImage Device_Memory::create(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage,
+                              Requirements& requirements) {
+
+    VkImage image = null;
+
+    Array<u32, 3> indices{device->queue_index(Queue_Family::graphics),
+                          device->queue_index(Queue_Family::compute),
+                          device->queue_index(Queue_Family::transfer)};
+
+    VkImageCreateInfo info = image_info(extent, format, usage, indices);
     RVK_CHECK(vkCreateImage(*device, &info, null, &image));
 
     VkImageMemoryRequirementsInfo2 image_requirements = {
@@ -104,35 +466,68 @@ Opt<Image> Device_Memory::make(VkExtent3D extent, VkFormat format, VkImageUsageF
         .image = image,
     };
 
+    VkMemoryDedicatedRequirements dedicated_requirements = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+    };
+
     VkMemoryRequirements2 memory_requirements = {
         .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+        .pNext = &dedicated_requirements,
     };
 
     vkGetImageMemoryRequirements2(*device, &image_requirements, &memory_requirements);
 
-    auto address = allocator.allocate(
-        memory_requirements.memoryRequirements.size,
-        Math::max(memory_requirements.memoryRequirements.alignment, buffer_image_granularity));
+    requirements.memory = memory_requirements.memoryRequirements;
+    requirements.prefers_dedicated = dedicated_requirements.prefersDedicatedAllocation;
+    requirements.requires_dedicated = dedicated_requirements.requiresDedicatedAllocation;
+    return image;
+}
 
-    if(!address.ok()) {
-        vkDestroyImage(*device, image, null);
-        return {};
-    }
+void Device_Memory::bind(VkImage image, u64 offset) {
 
     VkBindImageMemoryInfo bind = {
         .sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
         .pNext = null,
         .image = image,
         .memory = device_memory,
-        .memoryOffset = (*address)->offset,
+        .memoryOffset = offset,
     };
 
     RVK_CHECK(vkBindImageMemory2(*device, 1, &bind));
+}
+
+Opt<Image> Device_Memory::make(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage) {
+
+    Requirements requirements;
+    VkImage image = create(extent, format, usage, requirements);
+
+    if(wants_dedicated(requirements)) {
+        if(VkDeviceMemory memory = allocate_dedicated(requirements, null, image)) {
+            Image result{Arc<Device_Memory, Alloc>::from_this(this), null, requirements.memory.size,
+                         image, format, extent, usage};
+            result.dedicated = memory;
+            return Opt{move(result)};
+        }
+        if(requirements.requires_dedicated) {
+            vkDestroyImage(*device, image, null);
+            return {};
+        }
+    }
+
+    auto address = allocate(requirements.memory.size, requirements.memory.alignment);
+
+    if(!address.ok()) {
+        vkDestroyImage(*device, image, null);
+        return {};
+    }
+
+    bind(image, (*address)->offset);
 
-    return Opt{Image{Arc<Device_Memory, Alloc>::from_this(this), *address, image, format, extent}};
+    return Opt{Image{Arc<Device_Memory, Alloc>::from_this(this), *address,
+                     requirements.memory.size, image, format, extent, usage}};
 }
 
-Opt<Buffer> Device_Memory::make(u64 size, VkBufferUsageFlags usage) {
+VkBuffer Device_Memory::create(u64 size, VkBufferUsageFlags usage, Requirements& requirements) {
 
     VkBuffer buffer = null;
 
@@ -156,43 +551,268 @@ Opt<Buffer> Device_Memory::make(u64 size, VkBufferUsageFlags usage) {
         .buffer = buffer,
     };
 
+    VkMemoryDedicatedRequirements dedicated_requirements = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_REQUIREMENTS,
+    };
+
     VkMemoryRequirements2 memory_requirements = {
         .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2,
+        .pNext = &dedicated_requirements,
     };
 
     vkGetBufferMemoryRequirements2(*device, &buffer_requirements, &memory_requirements);
 
-    auto address = allocator.allocate(
-        memory_requirements.memoryRequirements.size,
-        Math::max(memory_requirements.memoryRequirements.alignment, buffer_image_granularity));
-    if(!address.ok()) {
-        vkDestroyBuffer(*device, buffer, null);
-        return {};
-    }
+    requirements.memory = memory_requirements.memoryRequirements;
+    requirements.prefers_dedicated = dedicated_requirements.prefersDedicatedAllocation;
+    requirements.requires_dedicated = dedicated_requirements.requiresDedicatedAllocation;
+    return buffer;
+}
+
+void Device_Memory::bind(VkBuffer buffer, u64 offset) {
 
     VkBindBufferMemoryInfo bind = {
         .sType = VK_STRUCTURE_TYPE_BIND_BUFFER_MEMORY_INFO,
         .buffer = buffer,
         .memory = device_memory,
-        .memoryOffset = (*address)->offset,
+        .memoryOffset = offset,
     };
 
     RVK_CHECK(vkBindBufferMemory2(*device, 1, &bind));
+}
+
+Opt<Buffer> Device_Memory::make(u64 size, VkBufferUsageFlags usage) {
+
+    Requirements requirements;
+    VkBuffer buffer = create(size, usage, requirements);
+
+    if(wants_dedicated(requirements)) {
+        if(VkDeviceMemory memory = allocate_dedicated(requirements, buffer, null)) {
+            Buffer result{Arc<Device_Memory, Alloc>::from_this(this), null,
+                          requirements.memory.size, buffer, size, usage};
+            result.dedicated = memory;
+            if(location != Heap::device) {
+                RVK_CHECK(vkMapMemory(*device, memory, 0, VK_WHOLE_SIZE, 0,
+                                      reinterpret_cast<void**>(&result.dedicated_map)));
+            }
+            return Opt<Buffer>{move(result)};
+        }
+        if(requirements.requires_dedicated) {
+            vkDestroyBuffer(*device, buffer, null);
+            return {};
+        }
+    }
+
+    auto address = allocate(requirements.memory.size, requirements.memory.alignment);
+    if(!address.ok()) {
+        vkDestroyBuffer(*device, buffer, null);
+        return {};
+    }
+
+    bind(buffer, (*address)->offset);
+
+    return Opt<Buffer>{Buffer{Arc<Device_Memory, Alloc>::from_this(this), *address,
+                              requirements.memory.size, buffer, size, usage}};
+}
+
+Opt<Aliased_Memory> Device_Memory::make_aliased(u64 size, u64 alignment) {
+    auto address = allocate(size, alignment);
+    if(!address.ok()) return {};
+    return Opt{Aliased_Memory{Arc<Device_Memory, Alloc>::from_this(this), *address, size}};
+}
+
+bool Device_Memory::wants_dedicated(const Requirements& requirements) {
+    if(requirements.requires_dedicated) return true;
+    // Host heaps are mapped once, so only use dedicated memory there when the driver requires it.
+    if(location != Heap::device) return false;
+    return requirements.prefers_dedicated || requirements.memory.size >= dedicated_threshold;
+}
+
+VkDeviceMemory Device_Memory::allocate_dedicated(const Requirements& requirements,
+                                                 VkBuffer buffer, VkImage image) {
+
+    VkMemoryDedicatedAllocateInfo dedicated_info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .image = image,
+        .buffer = buffer,
+    };
+
+    VkMemoryAllocateFlagsInfo flags = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_FLAGS_INFO,
+        .pNext = &dedicated_info,
+        .flags = VK_MEMORY_ALLOCATE_DEVICE_ADDRESS_BIT,
+    };
+
+    VkMemoryAllocateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = &flags,
+        .allocationSize = requirements.memory.size,
+        .memoryTypeIndex = device->heap_index(location),
+    };
+
+    VkDeviceMemory memory = null;
+    VkResult result = vkAllocateMemory(*device, &info, null, &memory);
+    if(result != VK_SUCCESS) {
+        warn("[rvk] Failed to allocate dedicated memory of size %mb: %",
+             requirements.memory.size / Math::MB(1), describe(result));
+        return null;
+    }
+
+    vkSetDeviceMemoryPriorityEXT(*device, memory, 1.0f);
+
+    if(buffer) {
+        VkBindBufferMemoryInfo bind = {
+            .sType = VK_STRUCTURE_TYPE_BIND_BUFFER_MEMORY_INFO,
+            .buffer = buffer,
+            .memory = memory,
+            .memoryOffset = 0,
+        };
+        RVK_CHECK(vkBindBufferMemory2(*device, 1, &bind));
+    } else {
+        VkBindImageMemoryInfo bind = {
+            .sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
+            .image = image,
+            .memory = memory,
+            .memoryOffset = 0,
+        };
+        RVK_CHECK(vkBindImageMemory2(*device, 1, &bind));
+    }
+
+    Thread::Lock lock{mutex};
+    if(closed.load()) {
+        vkFreeMemory(*device, memory, null);
+        return null;
+    }
+    dedicated_size += requirements.memory.size;
+    dedicated_count++;
+    return memory;
+}
+
+void Device_Memory::free_dedicated(VkDeviceMemory memory, u64 size) {
+    vkFreeMemory(*device, memory, null);
+
+    Thread::Lock lock{mutex};
+    dedicated_size -= size;
+    dedicated_count--;
+}
+
+void Device_Memory::track(Buffer& buffer) {
+    Thread::Lock lock{mutex};
+    // Replaces a detached entry, which cancels its move.
+    if(movables.contains(buffer.address->offset)) movables.erase(buffer.address->offset);
+    movables.insert(buffer.address->offset, Movable{.buffer = &buffer});
+}
+
+void Device_Memory::track(Image& image, VkImageLayout layout) {
+    Thread::Lock lock{mutex};
+    if(movables.contains(image.address->offset)) movables.erase(image.address->offset);
+    movables.insert(image.address->offset, Movable{.image = &image, .layout = layout});
+}
+
+void Device_Memory::retrack(Buffer& buffer) {
+    Thread::Lock lock{mutex};
+    movables.get(buffer.address->offset).buffer = &buffer;
+}
+
+void Device_Memory::retrack(Image& image) {
+    Thread::Lock lock{mutex};
+    movables.get(image.address->offset).image = &image;
+}
 
-    return Opt<Buffer>{Buffer{Arc<Device_Memory, Alloc>::from_this(this), *address, buffer, size}};
+void Device_Memory::untrack(u64 offset) {
+    Thread::Lock lock{mutex};
+    Movable& movable = movables.get(offset);
+    if(movable.moving) {
+        movable.buffer = null;
+        movable.image = null;
+    } else {
+        movables.erase(offset);
+    }
 }
 
-Image::Image(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address, VkImage image,
-             VkFormat format, VkExtent3D extent)
-    : memory(move(memory)), image(image), format_(format), extent_(extent), address(address){};
+bool Device_Memory::retire(bool movable, Heap_Allocator::Range address, VkBuffer buffer,
+                           VkImage image) {
+    // Resources that are not movable only have an entry if they were detached mid-move.
+    if(!movable && moves_in_flight.load() == 0) return false;
+
+    Thread::Lock lock{mutex};
+    if(!movables.contains(address->offset)) return false;
+    Movable& entry = movables.get(address->offset);
+    if(!entry.moving) {
+        movables.erase(address->offset);
+        return false;
+    }
+    entry.buffer = null;
+    entry.image = null;
+    entry.retired_buffer = buffer;
+    entry.retired_image = image;
+    entry.retired_address = address;
+    return true;
+}
+
+Aliased_Memory::Aliased_Memory(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address,
+                               u64 size)
+    : memory(move(memory)), address(address), size_(size) {
+}
+
+Aliased_Memory::~Aliased_Memory() {
+    if(address) memory->release(address, size_);
+    address = null;
+    size_ = 0;
+}
+
+Aliased_Memory::Aliased_Memory(Aliased_Memory&& src) {
+    *this = move(src);
+}
+
+Aliased_Memory& Aliased_Memory::operator=(Aliased_Memory&& src) {
+    assert(this != &src);
+    this->~Aliased_Memory();
+    memory = move(src.memory);
+    address = src.address;
+    src.address = null;
+    size_ = src.size_;
+    src.size_ = 0;
+    return *this;
+}
+
+Image Aliased_Memory::make(u64 offset, VkExtent3D extent, VkFormat format,
+                           VkImageUsageFlags usage) {
+    assert(address);
+
+    Device_Memory::Requirements requirements;
+    VkImage image = memory->create(extent, format, usage, requirements);
+
+    assert(offset % requirements.memory.alignment == 0);
+    assert(offset + requirements.memory.size <= size_);
+
+    memory->bind(image, address->offset + offset);
+    return Image{memory.dup(), null, 0, image, format, extent, usage};
+}
+
+Image::Image(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address, u64 size,
+             VkImage image, VkFormat format, VkExtent3D extent, VkImageUsageFlags usage)
+    : memory(move(memory)), image(image), format_(format), extent_(extent), usage_(usage),
+      address(address), allocation_size(size){};
 
 Image::~Image() {
     if(image) {
-        vkDestroyImage(*memory->device, image, null);
-        memory->release(address);
+        // Aliased images have neither a range nor dedicated memory.
+        if(dedicated) {
+            vkDestroyImage(*memory->device, image, null);
+            memory->free_dedicated(dedicated, allocation_size);
+        } else if(!address) {
+            vkDestroyImage(*memory->device, image, null);
+        } else if(!memory->retire(movable, address, null, image)) {
+            vkDestroyImage(*memory->device, image, null);
+            memory->release(address, allocation_size);
+        }
     }
     image = null;
     address = null;
+    dedicated = null;
+    allocation_size = 0;
+    usage_ = 0;
+    movable = false;
     extent_ = {};
     format_ = VK_FORMAT_UNDEFINED;
 }
@@ -211,15 +831,138 @@ Image& Image::operator=(Image&& src) {
     src.format_ = VK_FORMAT_UNDEFINED;
     address = src.address;
     src.address = null;
+    dedicated = src.dedicated;
+    src.dedicated = null;
+    allocation_size = src.allocation_size;
+    src.allocation_size = 0;
     extent_ = src.extent_;
     src.extent_ = {};
+    usage_ = src.usage_;
+    src.usage_ = 0;
+    movable = src.movable;
+    src.movable = false;
+    for(u32 i = 0; i < 3; i++) {
+        tracked[i] = src.tracked[i];
+        src.tracked[i] = {};
+    }
+    if(movable) memory->retrack(*this);
     return *this;
 }
 
+void Image::set_movable(bool enable, VkImageLayout layout) {
+    assert(image);
+    if(enable == movable) return;
+    if(enable) {
+        VkImageUsageFlags transfer =
+            VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+        if((usage_ & transfer) != transfer) {
+            warn("[rvk] Image must have transfer src and dst usage to be movable.");
+            return;
+        }
+        if(!address) {
+            warn("[rvk] Dedicated and aliased images cannot be moved.");
+            return;
+        }
+        memory->track(*this, layout);
+    } else {
+        memory->untrack(address->offset);
+    }
+    movable = enable;
+}
+
 Image_View Image::view(VkImageAspectFlags aspect) {
     return Image_View{*this, aspect};
 }
 
+VkImageAspectFlags Image::aspect() const {
+    switch(format_) {
+    case VK_FORMAT_D16_UNORM:
+    case VK_FORMAT_X8_D24_UNORM_PACK32:
+    case VK_FORMAT_D32_SFLOAT: return VK_IMAGE_ASPECT_DEPTH_BIT;
+    case VK_FORMAT_S8_UINT: return VK_IMAGE_ASPECT_STENCIL_BIT;
+    case VK_FORMAT_D16_UNORM_S8_UINT:
+    case VK_FORMAT_D24_UNORM_S8_UINT:
+    case VK_FORMAT_D32_SFLOAT_S8_UINT:
+        return VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    default: return VK_IMAGE_ASPECT_COLOR_BIT;
+    }
+}
+
+void Image::transition_to(Commands& commands, VkImageLayout layout, VkPipelineStageFlags2 stage,
+                          VkAccessFlags2 access, VkImageAspectFlags aspects) {
+    Region(R) {
+        Barriers<Mregion<R>> barriers;
+        transition_to(barriers, layout, stage, access, aspects);
+        barriers.flush(commands, VK_DEPENDENCY_BY_REGION_BIT);
+    }
+}
+
+Opt<Image::Source> Image::advance(u32 index, VkImageLayout layout, VkPipelineStageFlags2 stage,
+                                  VkAccessFlags2 access) {
+    assert(layout != VK_IMAGE_LAYOUT_UNDEFINED);
+
+    Tracked& state = tracked[index];
+    Source src = {state.layout, VK_PIPELINE_STAGE_2_NONE, VK_ACCESS_2_NONE};
+
+    bool transition = layout != state.layout;
+    bool barrier = transition;
+
+    if(transition || (access & write_accesses)) {
+        // Writes wait for all previous accesses, but only previous writes need to be made
+        // available.
+        src.stage = state.write_stage | state.read_stage;
+        src.access = state.write_access;
+        barrier |= src.stage != VK_PIPELINE_STAGE_2_NONE;
+    } else if(state.write_stage != VK_PIPELINE_STAGE_2_NONE) {
+        bool visible = (stage & ~state.visible_stage) == 0 && (access & ~state.visible_access) == 0;
+        if(!visible) {
+            src.stage = state.write_stage;
+            src.access = state.write_access;
+            barrier = true;
+        }
+    }
+
+    record(index, layout, stage, access);
+
+    if(!barrier) return {};
+    return Opt{src};
+}
+
+void Image::record(u32 index, VkImageLayout layout, VkPipelineStageFlags2 stage,
+                   VkAccessFlags2 access) {
+    Tracked& state = tracked[index];
+    bool write = (access & write_accesses) != 0;
+    if(write || layout != state.layout) {
+        state.write_stage = stage;
+        state.write_access = access & write_accesses;
+        state.read_stage = VK_PIPELINE_STAGE_2_NONE;
+        state.visible_stage = VK_PIPELINE_STAGE_2_NONE;
+        state.visible_access = VK_ACCESS_2_NONE;
+    }
+    if(!write) {
+        state.read_stage |= stage;
+        state.visible_stage |= stage;
+        state.visible_access |= access;
+    }
+    state.layout = layout;
+}
+
+void Image::track(VkImageAspectFlags aspect, VkImageLayout src_layout, VkImageLayout dst_layout,
+                  VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access) {
+    for(u32 i = 0; i < 3; i++) {
+        if(!(aspect & tracked_aspects[i])) continue;
+#ifdef RPP_DEBUG_BUILD
+        VkImageLayout layout = tracked[i].layout;
+        if(src_layout != VK_IMAGE_LAYOUT_UNDEFINED && layout != VK_IMAGE_LAYOUT_UNDEFINED &&
+           src_layout != layout) {
+            warn("[rvk] Transitioning image from layout % but it was left in layout %.",
+                 static_cast<u32>(src_layout), static_cast<u32>(layout));
+        }
+#endif
+        record(i, dst_layout, dst_stage, dst_access);
+    }
+}
+
 void Image::setup(Commands& commands, VkImageLayout layout) {
     assert(image);
     transition(commands, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, layout,
@@ -228,7 +971,10 @@ void Image::setup(Commands& commands, VkImageLayout layout) {
 }
 
 u64 Image::linear_size() const {
-    u64 pixels = extent_.width * extent_.height * extent_.depth;
+    return u64{extent_.width} * extent_.height * extent_.depth * texel_size();
+}
+
+u64 Image::texel_size() const {
     switch(format_) {
     case VK_FORMAT_R4G4_UNORM_PACK8:
     case VK_FORMAT_R8_UNORM:
@@ -238,7 +984,7 @@ u64 Image::linear_size() const {
     case VK_FORMAT_R8_UINT:
     case VK_FORMAT_R8_SINT:
     case VK_FORMAT_R8_SRGB:
-    case VK_FORMAT_S8_UINT: return pixels;
+    case VK_FORMAT_S8_UINT: return 1;
     case VK_FORMAT_R4G4B4A4_UNORM_PACK16:
     case VK_FORMAT_B4G4R4A4_UNORM_PACK16:
     case VK_FORMAT_R5G6B5_UNORM_PACK16:
@@ -260,7 +1006,7 @@ u64 Image::linear_size() const {
     case VK_FORMAT_R16_UINT:
     case VK_FORMAT_R16_SINT:
     case VK_FORMAT_R16_SFLOAT:
-    case VK_FORMAT_D16_UNORM: return pixels * 2;
+    case VK_FORMAT_D16_UNORM: return 2;
     case VK_FORMAT_R8G8B8_UNORM:
     case VK_FORMAT_R8G8B8_SNORM:
     case VK_FORMAT_R8G8B8_USCALED:
@@ -275,7 +1021,7 @@ u64 Image::linear_size() const {
     case VK_FORMAT_B8G8R8_UINT:
     case VK_FORMAT_B8G8R8_SINT:
     case VK_FORMAT_B8G8R8_SRGB:
-    case VK_FORMAT_D16_UNORM_S8_UINT: return pixels * 3;
+    case VK_FORMAT_D16_UNORM_S8_UINT: return 3;
     case VK_FORMAT_R8G8B8A8_UNORM:
     case VK_FORMAT_R8G8B8A8_SNORM:
     case VK_FORMAT_R8G8B8A8_USCALED:
@@ -323,15 +1069,15 @@ u64 Image::linear_size() const {
     case VK_FORMAT_E5B9G9R9_UFLOAT_PACK32:
     case VK_FORMAT_X8_D24_UNORM_PACK32:
     case VK_FORMAT_D32_SFLOAT:
-    case VK_FORMAT_D24_UNORM_S8_UINT: return pixels * 4;
-    case VK_FORMAT_D32_SFLOAT_S8_UINT: return pixels * 5;
+    case VK_FORMAT_D24_UNORM_S8_UINT: return 4;
+    case VK_FORMAT_D32_SFLOAT_S8_UINT: return 5;
     case VK_FORMAT_R16G16B16_UNORM:
     case VK_FORMAT_R16G16B16_SNORM:
     case VK_FORMAT_R16G16B16_USCALED:
     case VK_FORMAT_R16G16B16_SSCALED:
     case VK_FORMAT_R16G16B16_UINT:
     case VK_FORMAT_R16G16B16_SINT:
-    case VK_FORMAT_R16G16B16_SFLOAT: return pixels * 6;
+    case VK_FORMAT_R16G16B16_SFLOAT: return 6;
     case VK_FORMAT_R16G16B16A16_UNORM:
     case VK_FORMAT_R16G16B16A16_SNORM:
     case VK_FORMAT_R16G16B16A16_USCALED:
@@ -344,26 +1090,32 @@ u64 Image::linear_size() const {
     case VK_FORMAT_R32G32_SFLOAT:
     case VK_FORMAT_R64_UINT:
     case VK_FORMAT_R64_SINT:
-    case VK_FORMAT_R64_SFLOAT: return pixels * 8;
+    case VK_FORMAT_R64_SFLOAT: return 8;
     case VK_FORMAT_R32G32B32_UINT:
     case VK_FORMAT_R32G32B32_SINT:
-    case VK_FORMAT_R32G32B32_SFLOAT: return pixels * 12;
+    case VK_FORMAT_R32G32B32_SFLOAT: return 12;
     case VK_FORMAT_R32G32B32A32_UINT:
     case VK_FORMAT_R32G32B32A32_SINT:
     case VK_FORMAT_R32G32B32A32_SFLOAT:
     case VK_FORMAT_R64G64_UINT:
     case VK_FORMAT_R64G64_SINT:
-    case VK_FORMAT_R64G64_SFLOAT: return pixels * 16;
+    case VK_FORMAT_R64G64_SFLOAT: return 16;
     case VK_FORMAT_R64G64B64_UINT:
     case VK_FORMAT_R64G64B64_SINT:
-    case VK_FORMAT_R64G64B64_SFLOAT: return pixels * 24;
+    case VK_FORMAT_R64G64B64_SFLOAT: return 24;
     case VK_FORMAT_R64G64B64A64_UINT:
     case VK_FORMAT_R64G64B64A64_SINT:
-    case VK_FORMAT_R64G64B64A64_SFLOAT: return pixels * 32;
+    case VK_FORMAT_R64G64B64A64_SFLOAT: return 32;
     default: die("[rvk] image has unsupported format %.", static_cast<u32>(format_));
     }
 }
 
+void Image::reset(VkImageAspectFlags aspect, VkImageLayout layout) {
+    for(u32 i = 0; i < 3; i++) {
+        if(aspect & tracked_aspects[i]) tracked[i] = Tracked{.layout = layout};
+    }
+}
+
 void Image::from_buffer(Commands& commands, Buffer buffer) {
 
     assert(buffer.length() >= linear_size());
@@ -396,10 +1148,50 @@ void Image::from_buffer(Commands& commands, Buffer buffer) {
     };
 
     vkCmdCopyBufferToImage2(commands, &copy_info);
+    track(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_COPY_BIT,
+          VK_ACCESS_2_TRANSFER_WRITE_BIT);
 
     commands.attach(move(buffer));
 }
 
+void Image::from_buffer(Commands& commands, const Transient& transient) {
+
+    assert(transient.length >= linear_size());
+
+    VkBufferImageCopy2 copy = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2,
+        .pNext = null,
+        .bufferOffset = transient.offset,
+        .bufferRowLength = 0,
+        .bufferImageHeight = 0,
+        .imageSubresource =
+            {
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
+            },
+        .imageOffset = {0, 0, 0},
+        .imageExtent = extent_,
+    };
+
+    VkCopyBufferToImageInfo2 copy_info = {
+        .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_TO_IMAGE_INFO_2,
+        .pNext = null,
+        .srcBuffer = transient.buffer,
+        .dstImage = image,
+        .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .regionCount = 1,
+        .pRegions = &copy,
+    };
+
+    vkCmdCopyBufferToImage2(commands, &copy_info);
+    track(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_PIPELINE_STAGE_2_COPY_BIT,
+          VK_ACCESS_2_TRANSFER_WRITE_BIT);
+}
+
 void Image::to_buffer(Commands& commands, Buffer& buffer) {
 
     assert(buffer.length() >= linear_size());
@@ -432,43 +1224,21 @@ void Image::to_buffer(Commands& commands, Buffer& buffer) {
     };
 
     vkCmdCopyImageToBuffer2(commands, &copy_info);
+    track(VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+          VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_PIPELINE_STAGE_2_COPY_BIT,
+          VK_ACCESS_2_TRANSFER_READ_BIT);
 }
 
 void Image::transition(Commands& commands, VkImageAspectFlags aspect, VkImageLayout src_layout,
                        VkImageLayout dst_layout, VkPipelineStageFlags2 src_stage,
                        VkPipelineStageFlags2 dst_stage, VkAccessFlags2 src_access,
                        VkAccessFlags2 dst_access) {
-    assert(image);
-
-    VkImageMemoryBarrier2 barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-        .srcStageMask = src_stage,
-        .srcAccessMask = src_access,
-        .dstStageMask = dst_stage,
-        .dstAccessMask = dst_access,
-        .oldLayout = src_layout,
-        .newLayout = dst_layout,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = image,
-        .subresourceRange =
-            {
-                .aspectMask = aspect,
-                .baseMipLevel = 0,
-                .levelCount = 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            },
-    };
-
-    VkDependencyInfo dependency = {
-        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-        .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
-        .imageMemoryBarrierCount = 1,
-        .pImageMemoryBarriers = &barrier,
-    };
-
-    vkCmdPipelineBarrier2(commands, &dependency);
+    Region(R) {
+        Barriers<Mregion<R>> barriers;
+        transition(barriers, aspect, src_layout, dst_layout, src_stage, dst_stage, src_access,
+                   dst_access);
+        barriers.flush(commands, VK_DEPENDENCY_BY_REGION_BIT);
+    }
 }
 
 Image_View::Image_View(Image& image, VkImageAspectFlags aspect)
@@ -554,19 +1324,30 @@ Sampler& Sampler::operator=(Sampler&& src) {
     return *this;
 }
 
-Buffer::Buffer(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address, VkBuffer buffer,
-               u64 len)
-    : memory(move(memory)), buffer(buffer), len(len), address(address) {
+Buffer::Buffer(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address, u64 size,
+               VkBuffer buffer, u64 len, VkBufferUsageFlags usage)
+    : memory(move(memory)), buffer(buffer), len(len), usage_(usage), address(address),
+      allocation_size(size) {
 }
 
 Buffer::~Buffer() {
     if(buffer) {
-        vkDestroyBuffer(*memory->device, buffer, null);
-        memory->release(address);
+        if(dedicated) {
+            vkDestroyBuffer(*memory->device, buffer, null);
+            memory->free_dedicated(dedicated, allocation_size);
+        } else if(!memory->retire(movable, address, buffer, null)) {
+            vkDestroyBuffer(*memory->device, buffer, null);
+            memory->release(address, allocation_size);
+        }
     }
     buffer = null;
     address = null;
+    dedicated = null;
+    dedicated_map = null;
+    allocation_size = 0;
     len = 0;
+    usage_ = 0;
+    movable = false;
 }
 
 Buffer::Buffer(Buffer&& src) {
@@ -581,11 +1362,43 @@ Buffer& Buffer::operator=(Buffer&& src) {
     src.buffer = null;
     address = src.address;
     src.address = null;
+    dedicated = src.dedicated;
+    src.dedicated = null;
+    dedicated_map = src.dedicated_map;
+    src.dedicated_map = null;
+    allocation_size = src.allocation_size;
+    src.allocation_size = 0;
     len = src.len;
     src.len = 0;
+    usage_ = src.usage_;
+    src.usage_ = 0;
+    movable = src.movable;
+    src.movable = false;
+    if(movable) memory->retrack(*this);
     return *this;
 }
 
+void Buffer::set_movable(bool enable) {
+    assert(buffer);
+    if(enable == movable) return;
+    if(enable) {
+        VkBufferUsageFlags transfer =
+            VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        if((usage_ & transfer) != transfer) {
+            warn("[rvk] Buffer must have transfer src and dst usage to be movable.");
+            return;
+        }
+        if(dedicated) {
+            warn("[rvk] Dedicated buffers cannot be moved.");
+            return;
+        }
+        memory->track(*this);
+    } else {
+        memory->untrack(address->offset);
+    }
+    movable = enable;
+}
+
 u64 Buffer::gpu_address() const {
     if(!buffer) return 0;
     VkBufferDeviceAddressInfo info = {
@@ -597,6 +1410,7 @@ u64 Buffer::gpu_address() const {
 
 u8* Buffer::map() {
     if(buffer) {
+        if(dedicated) return dedicated_map;
         if(memory->persistent_map) {
             return memory->persistent_map + address->offset;
         }
@@ -655,10 +1469,237 @@ void Buffer::copy_from(Commands& commands, Buffer& src, u64 src_offset, u64 dst_
     vkCmdCopyBuffer2(commands, &info);
 }
 
+void Buffer::copy_from(Commands& commands, const Transient& from, u64 dst_offset) {
+    assert(buffer);
+    assert(dst_offset + from.length <= len);
+
+    VkBufferCopy2 region = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+        .srcOffset = from.offset,
+        .dstOffset = dst_offset,
+        .size = from.length,
+    };
+
+    VkCopyBufferInfo2 info = {
+        .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
+        .srcBuffer = from.buffer,
+        .dstBuffer = buffer,
+        .regionCount = 1,
+        .pRegions = &region,
+    };
+
+    vkCmdCopyBuffer2(commands, &info);
+}
+
+void Buffer::barrier(Commands& commands, VkPipelineStageFlags2 src_stage,
+                     VkPipelineStageFlags2 dst_stage, VkAccessFlags2 src_access,
+                     VkAccessFlags2 dst_access) {
+    Region(R) {
+        Barriers<Mregion<R>> barriers;
+        barrier(barriers, src_stage, dst_stage, src_access, dst_access);
+        barriers.flush(commands);
+    }
+}
+
 void Buffer::move_from(Commands& commands, Buffer from) {
     assert(buffer);
     copy_from(commands, from);
     commands.attach(move(from));
 }
 
+void Transient::write(Slice<const u8> data, u64 offset) {
+    assert(map);
+    assert(data.length() + offset <= length);
+
+    Libc::memcpy(map + offset, data.data(), data.length());
+}
+
+Buffer_Slice::Buffer_Slice(Arc<Buffer_Pool, Alloc> pool, u32 block,
+                           Buffer_Allocator::Range address, VkBuffer buffer, u8* block_map,
+                           u64 block_address, u64 len)
+    : pool(move(pool)), buffer(buffer), block(block), len(len), block_map(block_map),
+      block_address(block_address), address(address) {
+}
+
+Buffer_Slice::~Buffer_Slice() {
+    if(address) {
+        pool->release(block, address);
+    }
+    buffer = null;
+    address = null;
+    block = 0;
+    len = 0;
+    block_map = null;
+    block_address = 0;
+}
+
+Buffer_Slice::Buffer_Slice(Buffer_Slice&& src) {
+    *this = move(src);
+}
+
+Buffer_Slice& Buffer_Slice::operator=(Buffer_Slice&& src) {
+    assert(this != &src);
+    this->~Buffer_Slice();
+    pool = move(src.pool);
+    buffer = src.buffer;
+    src.buffer = null;
+    block = src.block;
+    src.block = 0;
+    len = src.len;
+    src.len = 0;
+    block_map = src.block_map;
+    src.block_map = null;
+    block_address = src.block_address;
+    src.block_address = 0;
+    address = src.address;
+    src.address = null;
+    return *this;
+}
+
+u64 Buffer_Slice::gpu_address() const {
+    if(!address || !block_address) return 0;
+    return block_address + address->offset;
+}
+
+u8* Buffer_Slice::map() {
+    if(address && block_map) {
+        return block_map + address->offset;
+    }
+    return null;
+}
+
+void Buffer_Slice::write(Slice<const u8> data, u64 offset) {
+    assert(address);
+    assert(data.length() + offset <= len);
+
+    Libc::memcpy(map() + offset, data.data(), data.length());
+}
+
+void Buffer_Slice::copy_from(Commands& commands, const Transient& from, u64 dst_offset) {
+    assert(address);
+    assert(dst_offset + from.length <= len);
+
+    VkBufferCopy2 region = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+        .srcOffset = from.offset,
+        .dstOffset = offset() + dst_offset,
+        .size = from.length,
+    };
+
+    VkCopyBufferInfo2 info = {
+        .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
+        .srcBuffer = from.buffer,
+        .dstBuffer = buffer,
+        .regionCount = 1,
+        .pRegions = &region,
+    };
+
+    vkCmdCopyBuffer2(commands, &info);
+}
+
+Buffer_Pool::Block::Block(Buffer B) : buffer(move(B)), allocator(buffer.length()) {
+    map = buffer.map();
+    if(buffer.memory->addressable()) {
+        gpu_address = buffer.gpu_address();
+    }
+}
+
+Buffer_Pool::Buffer_Pool(VkBufferUsageFlags usage, u64 block_size, u64 alignment)
+    : usage_(usage), block_size_(block_size), alignment(alignment) {
+}
+
+Buffer_Pool::~Buffer_Pool() {
+    Thread::Lock lock{mutex};
+    for(auto& block : blocks) {
+        block->allocator.statistics().assert_clear();
+    }
+    if(!blocks.empty()) {
+        info("[rvk] Destroyed buffer pool with % block(s) for usage %.", blocks.length(),
+             usage_);
+    }
+}
+
+void Buffer_Pool::imgui() {
+    using namespace ImGui;
+    Thread::Lock lock{mutex};
+    Text("Usage: 0x%x | Blocks: %lu | Alignment: %lu", usage_, blocks.length(), alignment);
+    for(auto& block : blocks) {
+        auto stat = block->allocator.statistics();
+        Text("Alloc: %lukb | Free: %lukb | Alloc Blocks: %lu", stat.allocated_size / 1024,
+             stat.free_size / 1024, stat.allocated_blocks);
+    }
+}
+
+Opt<Buffer_Slice> Buffer_Pool::make(u64 size) {
+    assert(size <= block_size_);
+
+    Thread::Lock lock{mutex};
+    for(u32 i = 0; i < blocks.length(); i++) {
+        Block& block = *blocks[i];
+        if(auto address = block.allocator.allocate(size, alignment); address.ok()) {
+            return Opt{Buffer_Slice{Arc<Buffer_Pool, Alloc>::from_this(this), i, *address,
+                                    block.buffer, block.map, block.gpu_address, size}};
+        }
+    }
+    return {};
+}
+
+void Buffer_Pool::grow(Buffer buffer) {
+    Thread::Lock lock{mutex};
+    blocks.push(Box<Block, Alloc>::make(move(buffer)));
+    info("[rvk] Grew buffer pool for usage % to % block(s).", usage_, blocks.length());
+}
+
+void Buffer_Pool::release(u32 block, Buffer_Allocator::Range address) {
+    Thread::Lock lock{mutex};
+    blocks[block]->allocator.free(address);
+}
+
+Transient_Allocator::Transient_Allocator(Buffer B, u32 frames_in_flight, u64 region_alignment)
+    : buffer(move(B)) {
+    assert(buffer.map());
+    region_size = buffer.length() / frames_in_flight / region_alignment * region_alignment;
+    info("[rvk] Created transient heap with % region(s) of size %mb.", frames_in_flight,
+         region_size / Math::MB(1));
+}
+
+void Transient_Allocator::imgui() {
+    using namespace ImGui;
+    u64 used = Math::min(static_cast<u64>(head.load()) & offset_mask, region_size);
+    Text("Used: %lukb / %lukb | Overflows: %lu", used / 1024, region_size / 1024,
+         static_cast<u64>(overflows.load()));
+}
+
+void Transient_Allocator::reset(u32 frame_index) {
+    i64 dropped = overflows.exchange(0);
+    if(dropped > 0) {
+        warn("[rvk] % transient allocation(s) overflowed into the host heap.", dropped);
+    }
+    head.store(static_cast<i64>(u64{frame_index} << region_shift));
+}
+
+Opt<Transient> Transient_Allocator::allocate(u64 size, u64 alignment) {
+    assert(alignment && (alignment & (alignment - 1)) == 0);
+
+    // Alignment applies to the offset in the buffer, not in the region.
+    i64 current = head.load();
+    for(;;) {
+        u64 region = static_cast<u64>(current) >> region_shift;
+        u64 region_base = region * region_size;
+        u64 address = region_base + (static_cast<u64>(current) & offset_mask);
+        u64 offset = ((address + alignment - 1) & ~(alignment - 1)) - region_base;
+        if(offset + size > region_size) {
+            overflows.incr();
+            return {};
+        }
+        i64 next = static_cast<i64>(region << region_shift | (offset + size));
+        i64 prev = head.compare_and_swap(current, next);
+        if(prev == current) {
+            address = region_base + offset;
+            return Opt{Transient{buffer, address, size, buffer.map() + address}};
+        }
+        current = prev;
+    }
+}
+
 } // namespace rvk::impl
@@ -7,6 +7,7 @@
 
 #include "fwd.h"
 
+#include "barriers.h"
 #include "device.h"
 
 namespace rvk::impl {
@@ -33,15 +34,99 @@ struct Device_Memory {
 
     Heap_Allocator::Stats stats();
 
+    // Device and dynamic heaps support buffer device addresses.
+    bool addressable() const {
+        return location == Heap::device || location == Heap::dynamic;
+    }
+
+    u64 size();
+    bool empty();
+    // Makes all further allocations fail if the heap is empty, atomically with the check.
+    bool close();
+
     Opt<Buffer> make(u64 size, VkBufferUsageFlags usage);
     Opt<Image> make(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage);
+    Opt<Aliased_Memory> make_aliased(u64 size, u64 alignment);
 
 private:
     explicit Device_Memory(Arc<Physical_Device, Alloc>& physical_device, Arc<Device, Alloc> device,
-                           Heap location, u64 size);
+                           Heap location, u64 size, u64 cache_limit, u64 dedicated_threshold);
     friend struct Arc<Device_Memory, Alloc>;
 
-    void release(Heap_Allocator::Range address);
+    // Allocations up to cache_limit bytes are rounded up to a power of two size class and
+    // served from a per-thread magazine, so they only touch the shared allocator (and its
+    // mutex) once per batch. Released blocks go back to the releasing thread's magazine, and
+    // overflowing magazines are returned to the shared allocator in batches.
+    static constexpr u64 min_cache_class = 256;
+    static constexpr u64 max_cache_classes = 16;
+    static constexpr u64 cache_batch = 8;
+
+    struct Thread_Cache {
+        u64 memory_id = 0;
+        Device_Memory* memory = null;
+        Array<Vec<Heap_Allocator::Range, Alloc>, max_cache_classes> magazines;
+    };
+
+    // Caches of destroyed heaps are pruned by their thread once it sees a new cache_epoch.
+    struct This_Thread {
+        ~This_Thread();
+        void prune();
+        Vec<Box<Thread_Cache, Alloc>, Alloc> caches;
+        i64 epoch; // Zero-initialized, as this_thread has thread storage duration.
+    };
+
+    static inline thread_local This_Thread this_thread;
+
+    Opt<Heap_Allocator::Range> allocate(u64 size, u64 alignment);
+    void release(Heap_Allocator::Range address, u64 size);
+
+    struct Requirements {
+        VkMemoryRequirements memory = {};
+        bool prefers_dedicated = false;
+        bool requires_dedicated = false;
+    };
+
+    VkBuffer create(u64 size, VkBufferUsageFlags usage, Requirements& requirements);
+    VkImage create(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage,
+                   Requirements& requirements);
+    void bind(VkBuffer buffer, u64 offset);
+    void bind(VkImage image, u64 offset);
+
+    // Resources the driver requires in their own allocation get a separate VkDeviceMemory
+    // instead of a heap range. On the device heap, so do resources it prefers there and those
+    // that are at least dedicated_threshold bytes.
+    bool wants_dedicated(const Requirements& requirements);
+    VkDeviceMemory allocate_dedicated(const Requirements& requirements, VkBuffer buffer,
+                                      VkImage image);
+    void free_dedicated(VkDeviceMemory memory, u64 size);
+
+    // Resources that may be relocated by the Defragmenter, keyed by their offset in the heap.
+    // A resource that stops being movable while its copy is in flight is detached: its entry
+    // stays until the copy completes, without the resource. If it is destroyed by then, its
+    // handle and range are retired into the entry, and the Defragmenter frees them.
+    struct Movable {
+        Buffer* buffer = null;
+        Image* image = null;
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        bool moving = false;
+        VkBuffer retired_buffer = null;
+        VkImage retired_image = null;
+        Heap_Allocator::Range retired_address = null;
+    };
+
+    void track(Buffer& buffer);
+    void track(Image& image, VkImageLayout layout);
+    void retrack(Buffer& buffer);
+    void retrack(Image& image);
+    void untrack(u64 offset);
+    // Called when a resource with a heap range is destroyed. Returns whether its copy is in
+    // flight, in which case the handle and range now belong to the Defragmenter.
+    bool retire(bool movable, Heap_Allocator::Range address, VkBuffer buffer, VkImage image);
+
+    bool unused();
+    Opt<u64> cache_class(u64 size);
+    Thread_Cache& thread_cache();
+    void flush(Thread_Cache& cache);
 
     Arc<Device, Alloc> device;
 
@@ -50,13 +135,104 @@ private:
     Heap location = Heap::device;
     u8* persistent_map = null;
     u64 buffer_image_granularity = 0;
+    u64 dedicated_threshold = 0;
+    u64 dedicated_size = 0;
+    u64 dedicated_count = 0;
+
+    u64 id = 0;
+    u64 cache_base = 0;
+    u64 cache_classes = 0;
+    // Bytes drawn from the allocator into thread caches, and the number of those ranges that
+    // are currently allocated rather than parked in a magazine.
+    u64 cached_size = 0;
+    Thread::Atomic live_cached;
+    Vec<Thread_Cache*, Alloc> thread_caches;
+    // Set under the mutex by close(). Cached allocations count themselves as live before
+    // checking it, so close() either sees them or they see it.
+    Thread::Atomic closed;
+
+    Thread::Mutex mutex;
     Heap_Allocator allocator;
+    Map<u64, Movable, Alloc> movables;
+    // Copies started by the Defragmenter that have not been applied or cancelled.
+    Thread::Atomic moves_in_flight;
 
     friend struct Image;
     friend struct Image_View;
+    friend struct Aliased_Memory;
     friend struct Buffer;
     friend struct TLAS;
     friend struct BLAS;
+    friend struct Buffer_Pool;
+    friend struct Defragmenter;
+};
+
+// A heap made of Device_Memory blocks that are allocated on demand. New blocks are limited by
+// both the configured limit and the VK_EXT_memory_budget estimate, and blocks that stay empty
+// for trim_frames consecutive calls to trim() are freed. The first block is never freed.
+struct Memory_Pool {
+
+    struct Config {
+        Heap location = Heap::device;
+        u64 block_size = 0;
+        u64 limit = 0;
+        u64 cache_limit = 0;
+        u64 dedicated_threshold = 0;
+        u32 trim_frames = 0;
+    };
+
+    ~Memory_Pool() = default;
+
+    Memory_Pool(const Memory_Pool&) = delete;
+    Memory_Pool& operator=(const Memory_Pool&) = delete;
+    Memory_Pool(Memory_Pool&&) = delete;
+    Memory_Pool& operator=(Memory_Pool&&) = delete;
+
+    void imgui();
+    void trim();
+
+    Vec<Arc<Device_Memory, Alloc>, Alloc> blocks();
+
+    Opt<Buffer> make(u64 size, VkBufferUsageFlags usage);
+    Opt<Image> make(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage);
+    Opt<Aliased_Memory> make_aliased(u64 size, u64 alignment);
+
+    // Requirements of an image created by make, without creating it.
+    VkMemoryRequirements requirements(VkExtent3D extent, VkFormat format,
+                                      VkImageUsageFlags usage);
+
+    // Tries f on each block, then on a new block with room for at least size bytes.
+    template<typename T, typename F>
+    Opt<T> make(u64 size, F&& f) {
+        for(auto& memory : blocks()) {
+            if(auto result = f(memory); result.ok()) return result;
+        }
+        if(auto memory = grow(size); memory.ok()) {
+            return f(*memory);
+        }
+        return {};
+    }
+
+private:
+    explicit Memory_Pool(Arc<Physical_Device, Alloc> physical_device, Arc<Device, Alloc> device,
+                         Config config);
+    friend struct Arc<Memory_Pool, Alloc>;
+
+    Opt<Arc<Device_Memory, Alloc>> grow(u64 size);
+
+    struct Block {
+        Arc<Device_Memory, Alloc> memory;
+        u32 empty_frames = 0;
+    };
+
+    Arc<Physical_Device, Alloc> physical_device;
+    Arc<Device, Alloc> device;
+    Config config;
+
+    Thread::Mutex mutex;
+    Vec<Block, Alloc> blocks_;
+    u64 reserved = 0;
+    u64 freed_blocks = 0;
 };
 
 struct Image {
@@ -78,34 +254,176 @@ struct Image {
     VkExtent3D extent() const {
         return extent_;
     }
+    // All aspects of the format.
+    VkImageAspectFlags aspect() const;
 
+    // Bytes per texel.
+    u64 texel_size() const;
     u64 linear_size() const;
 
     Image_View view(VkImageAspectFlags aspect);
 
+    // Images remember the layout and the last accesses of each aspect as they are recorded, so
+    // transition_to only records the barrier an access needs: none between reads that are
+    // already synchronized, and source stages limited to the previous accesses otherwise. The
+    // first transition discards the contents, so setup is not needed. Tracking assumes
+    // commands execute in the order they are recorded, so images recorded by several threads
+    // or into buffers submitted out of order should use explicit transitions. Explicit
+    // transitions update the tracked state, and debug builds warn when their source layout
+    // does not match it. An aspect of 0 selects all aspects.
+    void transition_to(Commands& commands, VkImageLayout layout, VkPipelineStageFlags2 stage,
+                       VkAccessFlags2 access, VkImageAspectFlags aspects = 0);
+
+    template<typename A>
+    void transition_to(Barriers<A>& barriers, VkImageLayout layout, VkPipelineStageFlags2 stage,
+                       VkAccessFlags2 access, VkImageAspectFlags aspects = 0) {
+        assert(image);
+        if(!aspects) aspects = aspect();
+        for(u32 i = 0; i < 3; i++) {
+            if(!(aspects & tracked_aspects[i])) continue;
+            if(auto src = advance(i, layout, stage, access); src.ok()) {
+                barriers.image(image,
+                               VkImageSubresourceRange{
+                                   .aspectMask = tracked_aspects[i],
+                                   .baseMipLevel = 0,
+                                   .levelCount = 1,
+                                   .baseArrayLayer = 0,
+                                   .layerCount = 1,
+                               },
+                               src->layout, layout, src->stage, stage, src->access, access);
+            }
+        }
+    }
+
+    // The Commands overloads record the barrier immediately. The Barriers overloads add it to
+    // a batch, so several images can be transitioned with one command.
     void setup(Commands& commands, VkImageLayout layout);
     void transition(Commands& commands, VkImageAspectFlags aspect, VkImageLayout src_layout,
                     VkImageLayout dst_layout, VkPipelineStageFlags2 src_stage,
                     VkPipelineStageFlags2 dst_stage, VkAccessFlags2 src_access,
                     VkAccessFlags2 dst_access);
 
+    template<typename A>
+    void setup(Barriers<A>& barriers, VkImageLayout layout) {
+        transition(barriers, VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_LAYOUT_UNDEFINED, layout,
+                   VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
+                   VK_ACCESS_2_NONE, VK_ACCESS_2_NONE);
+    }
+    template<typename A>
+    void transition(Barriers<A>& barriers, VkImageAspectFlags aspect, VkImageLayout src_layout,
+                    VkImageLayout dst_layout, VkPipelineStageFlags2 src_stage,
+                    VkPipelineStageFlags2 dst_stage, VkAccessFlags2 src_access,
+                    VkAccessFlags2 dst_access) {
+        assert(image);
+        track(aspect, src_layout, dst_layout, dst_stage, dst_access);
+        barriers.image(image,
+                       VkImageSubresourceRange{
+                           .aspectMask = aspect,
+                           .baseMipLevel = 0,
+                           .levelCount = 1,
+                           .baseArrayLayer = 0,
+                           .layerCount = 1,
+                       },
+                       src_layout, dst_layout, src_stage, dst_stage, src_access, dst_access);
+    }
+
+    // The image must be in the transfer destination (or source) layout, and the copy is
+    // recorded in its tracked state.
     void from_buffer(Commands& commands, Buffer buffer);
+    void from_buffer(Commands& commands, const Transient& transient);
     void to_buffer(Commands& commands, Buffer& buffer);
 
+    // Allows the defragmenter to move this image while it is in the given layout. The image
+    // must no longer be written by the GPU, and must have been created with both transfer
+    // usages. Moving replaces the VkImage, so views must be recreated in the relocation callback.
+    // Dedicated and aliased images cannot be moved.
+    void set_movable(bool movable,
+                     VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+
 private:
-    explicit Image(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address, VkImage image,
-                   VkFormat format, VkExtent3D extent);
+    explicit Image(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address, u64 size,
+                   VkImage image, VkFormat format, VkExtent3D extent, VkImageUsageFlags usage);
+
+    // State of one aspect. The last write includes layout transitions, and the visible stages
+    // and accesses are the reads it has been made visible to.
+    struct Tracked {
+        VkImageLayout layout;
+        VkPipelineStageFlags2 write_stage;
+        VkAccessFlags2 write_access;
+        VkPipelineStageFlags2 read_stage;
+        VkPipelineStageFlags2 visible_stage;
+        VkAccessFlags2 visible_access;
+    };
+
+    // Source scope of the barrier needed by an access.
+    struct Source {
+        VkImageLayout layout;
+        VkPipelineStageFlags2 stage;
+        VkAccessFlags2 access;
+    };
+
+    static constexpr VkImageAspectFlagBits tracked_aspects[3] = {
+        VK_IMAGE_ASPECT_COLOR_BIT, VK_IMAGE_ASPECT_DEPTH_BIT, VK_IMAGE_ASPECT_STENCIL_BIT};
+
+    Opt<Source> advance(u32 index, VkImageLayout layout, VkPipelineStageFlags2 stage,
+                        VkAccessFlags2 access);
+    void record(u32 index, VkImageLayout layout, VkPipelineStageFlags2 stage,
+                VkAccessFlags2 access);
+    void track(VkImageAspectFlags aspect, VkImageLayout src_layout, VkImageLayout dst_layout,
+               VkPipelineStageFlags2 dst_stage, VkAccessFlags2 dst_access);
+    // Records that the aspects were left in the layout by work that later accesses are already
+    // synchronized with, such as an upload batch awaited through its semaphore.
+    void reset(VkImageAspectFlags aspect, VkImageLayout layout);
 
     Arc<Device_Memory, Alloc> memory;
 
     VkImage image = null;
     VkFormat format_ = VK_FORMAT_UNDEFINED;
     VkExtent3D extent_ = {};
+    VkImageUsageFlags usage_ = 0;
     Heap_Allocator::Range address = null;
+    VkDeviceMemory dedicated = null;
+    u64 allocation_size = 0;
+    bool movable = false;
+    Tracked tracked[3] = {};
 
     friend struct Device_Memory;
     friend struct Image_View;
+    friend struct Aliased_Memory;
     friend struct Swapchain;
+    friend struct Defragmenter;
+    friend struct Uploader;
+};
+
+// A heap range that images are bound into at chosen offsets, so images whose uses never
+// overlap in time can share memory. The images own no memory: their contents are undefined
+// after another image at an overlapping offset was used, and they must not outlive the range.
+struct Aliased_Memory {
+
+    Aliased_Memory() = default;
+    ~Aliased_Memory();
+
+    Aliased_Memory(const Aliased_Memory&) = delete;
+    Aliased_Memory& operator=(const Aliased_Memory&) = delete;
+    Aliased_Memory(Aliased_Memory&& src);
+    Aliased_Memory& operator=(Aliased_Memory&& src);
+
+    u64 size() const {
+        return size_;
+    }
+
+    // The offset must satisfy the image's alignment requirement.
+    Image make(u64 offset, VkExtent3D extent, VkFormat format, VkImageUsageFlags usage);
+
+private:
+    explicit Aliased_Memory(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address,
+                            u64 size);
+
+    Arc<Device_Memory, Alloc> memory;
+    Heap_Allocator::Range address = null;
+    u64 size_ = 0;
+
+    friend struct Device_Memory;
 };
 
 struct Image_View {
@@ -193,22 +511,193 @@ struct Buffer {
     void move_from(Commands& commands, Buffer from);
     void copy_from(Commands& commands, Buffer& from);
     void copy_from(Commands& commands, Buffer& from, u64 src_offset, u64 dst_offset, u64 size);
+    void copy_from(Commands& commands, const Transient& from, u64 dst_offset = 0);
+
+    // Barriers cover the whole buffer.
+    void barrier(Commands& commands, VkPipelineStageFlags2 src_stage,
+                 VkPipelineStageFlags2 dst_stage, VkAccessFlags2 src_access,
+                 VkAccessFlags2 dst_access);
+
+    template<typename A>
+    void barrier(Barriers<A>& barriers, VkPipelineStageFlags2 src_stage,
+                 VkPipelineStageFlags2 dst_stage, VkAccessFlags2 src_access,
+                 VkAccessFlags2 dst_access) {
+        assert(buffer);
+        barriers.buffer(buffer, src_stage, dst_stage, src_access, dst_access);
+    }
+
+    // Allows the defragmenter to move this buffer. The buffer must no longer be written by the
+    // GPU, and must have been created with both transfer usages. Moving replaces the VkBuffer
+    // and its device address, which are reported to the relocation callback. Dedicated buffers
+    // cannot be moved.
+    void set_movable(bool movable);
 
     operator VkBuffer() const {
         return buffer;
     }
 
 private:
-    explicit Buffer(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address,
-                    VkBuffer buffer, u64 len);
+    explicit Buffer(Arc<Device_Memory, Alloc> memory, Heap_Allocator::Range address, u64 size,
+                    VkBuffer buffer, u64 len, VkBufferUsageFlags usage);
 
     Arc<Device_Memory, Alloc> memory;
 
     VkBuffer buffer = null;
     u64 len = 0;
+    VkBufferUsageFlags usage_ = 0;
     Heap_Allocator::Range address = null;
+    VkDeviceMemory dedicated = null;
+    u8* dedicated_map = null;
+    u64 allocation_size = 0;
+    bool movable = false;
 
     friend struct Device_Memory;
+    friend struct Defragmenter;
+    friend struct Transient_Allocator;
+    friend struct Buffer_Pool;
+};
+
+// A range of one of the large buffers owned by a Buffer_Pool. Slices share the VkBuffer and
+// memory binding of their block, so creating one is only an allocator operation.
+struct Buffer_Slice {
+
+    Buffer_Slice() = default;
+    ~Buffer_Slice();
+
+    Buffer_Slice(const Buffer_Slice& src) = delete;
+    Buffer_Slice& operator=(const Buffer_Slice& src) = delete;
+
+    Buffer_Slice(Buffer_Slice&& src);
+    Buffer_Slice& operator=(Buffer_Slice&& src);
+
+    // Offset of the slice within its VkBuffer.
+    u64 offset() {
+        return address ? address->offset : 0;
+    }
+    u64 length() {
+        return len;
+    }
+    u64 gpu_address() const;
+
+    u8* map();
+    void write(Slice<const u8> data, u64 offset = 0);
+
+    void copy_from(Commands& commands, const Transient& from, u64 dst_offset = 0);
+
+    operator VkBuffer() const {
+        return buffer;
+    }
+
+private:
+    explicit Buffer_Slice(Arc<Buffer_Pool, Alloc> pool, u32 block, Buffer_Allocator::Range address,
+                          VkBuffer buffer, u8* block_map, u64 block_address, u64 len);
+
+    Arc<Buffer_Pool, Alloc> pool;
+
+    VkBuffer buffer = null;
+    u32 block = 0;
+    u64 len = 0;
+    u8* block_map = null;
+    u64 block_address = 0;
+    Buffer_Allocator::Range address = null;
+
+    friend struct Buffer_Pool;
+};
+
+struct Buffer_Pool {
+
+    ~Buffer_Pool();
+
+    Buffer_Pool(const Buffer_Pool&) = delete;
+    Buffer_Pool& operator=(const Buffer_Pool&) = delete;
+    Buffer_Pool(Buffer_Pool&&) = delete;
+    Buffer_Pool& operator=(Buffer_Pool&&) = delete;
+
+    void imgui();
+
+    VkBufferUsageFlags usage() const {
+        return usage_;
+    }
+    u64 block_size() const {
+        return block_size_;
+    }
+
+    // Returns an empty Opt if no block has room; the caller may then grow() the pool.
+    Opt<Buffer_Slice> make(u64 size);
+    void grow(Buffer block);
+
+private:
+    explicit Buffer_Pool(VkBufferUsageFlags usage, u64 block_size, u64 alignment);
+    friend struct Arc<Buffer_Pool, Alloc>;
+
+    void release(u32 block, Buffer_Allocator::Range address);
+
+    struct Block {
+        explicit Block(Buffer buffer);
+
+        Buffer buffer;
+        Buffer_Allocator allocator;
+        u8* map = null;
+        u64 gpu_address = 0;
+    };
+
+    VkBufferUsageFlags usage_ = 0;
+    u64 block_size_ = 0;
+    u64 alignment = 0;
+
+    Thread::Mutex mutex;
+    Vec<Box<Block, Alloc>, Alloc> blocks;
+
+    friend struct Buffer_Slice;
+};
+
+// A slice of the transient heap. The memory stays valid until the frame slot it was
+// allocated in comes around again, i.e. the same lifetime as a resource passed to drop().
+struct Transient {
+    VkBuffer buffer = null;
+    u64 offset = 0;
+    u64 length = 0;
+    u8* map = null;
+
+    operator VkBuffer() const {
+        return buffer;
+    }
+
+    void write(Slice<const u8> data, u64 offset = 0);
+};
+
+struct Transient_Allocator {
+
+    ~Transient_Allocator() = default;
+
+    Transient_Allocator(const Transient_Allocator&) = delete;
+    Transient_Allocator& operator=(const Transient_Allocator&) = delete;
+    Transient_Allocator(Transient_Allocator&&) = delete;
+    Transient_Allocator& operator=(Transient_Allocator&&) = delete;
+
+    void imgui();
+
+    // Must only be called after the previous use of the frame slot has completed.
+    void reset(u32 frame_index);
+
+    // Must not overlap begin_frame: an allocation racing with reset() is consistent, but may
+    // land in the previous slot, which is reused one frame early.
+    Opt<Transient> allocate(u64 size, u64 alignment);
+
+private:
+    explicit Transient_Allocator(Buffer buffer, u32 frames_in_flight, u64 region_alignment);
+    friend struct Arc<Transient_Allocator, Alloc>;
+
+    Buffer buffer;
+
+    // The head packs the current region index above region_shift and the offset in the
+    // region below it, so reset() switches both at once.
+    static constexpr u64 region_shift = 40;
+    static constexpr u64 offset_mask = (u64{1} << region_shift) - 1;
+
+    u64 region_size = 0;
+    Thread::Atomic head;
+    Thread::Atomic overflows;
 };
 
 } // namespace rvk::impl
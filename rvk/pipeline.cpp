@@ -5,6 +5,7 @@
 #include "device.h"
 #include "pipeline.h"
 #include "rvk.h"
+#include "trace.h"
 
 namespace rvk::impl {
 
@@ -125,6 +126,7 @@ void Pipeline::shader_group_handles_write(u8* data, u64 length) {
 }
 
 Pipeline::Pipeline(Arc<Device, Alloc> D, Info info) : device(move(D)) {
+    Event_Scope scope{"Create pipeline"_v};
     Region(R) {
 
         Vec<VkDescriptorSetLayout, Mregion<R>> layouts(info.descriptor_set_layouts.length());
@@ -141,30 +143,35 @@ Pipeline::Pipeline(Arc<Device, Alloc> D, Info info) : device(move(D)) {
 
         RVK_CHECK(vkCreatePipelineLayout(*device, &layout_info, null, &layout));
 
+        VkPipelineCache cache = device->pipeline_cache();
+        Profile::Time_Point start = Profile::timestamp();
+
         info.info.match(Overload{
-            [this](VkGraphicsPipelineCreateInfo& graphics) {
+            [this, cache](VkGraphicsPipelineCreateInfo& graphics) {
                 kind = Kind::graphics;
                 auto vk_info = graphics;
                 vk_info.layout = layout;
                 n_shaders = vk_info.stageCount;
-                RVK_CHECK(vkCreateGraphicsPipelines(*device, null, 1, &vk_info, null, &pipeline));
+                RVK_CHECK(vkCreateGraphicsPipelines(*device, cache, 1, &vk_info, null, &pipeline));
             },
-            [this](VkComputePipelineCreateInfo& compute) {
+            [this, cache](VkComputePipelineCreateInfo& compute) {
                 kind = Kind::compute;
                 auto vk_info = compute;
                 vk_info.layout = layout;
                 n_shaders = 1;
-                RVK_CHECK(vkCreateComputePipelines(*device, null, 1, &vk_info, null, &pipeline));
+                RVK_CHECK(vkCreateComputePipelines(*device, cache, 1, &vk_info, null, &pipeline));
             },
-            [this](VkRayTracingPipelineCreateInfoKHR& ray_tracing) {
+            [this, cache](VkRayTracingPipelineCreateInfoKHR& ray_tracing) {
                 kind = Kind::ray_tracing;
                 auto vk_info = ray_tracing;
                 vk_info.layout = layout;
                 n_shaders = vk_info.groupCount;
-                RVK_CHECK(vkCreateRayTracingPipelinesKHR(*device, null, null, 1, &vk_info, null,
+                RVK_CHECK(vkCreateRayTracingPipelinesKHR(*device, null, cache, 1, &vk_info, null,
                                                          &pipeline));
             },
         });
+
+        device->record_pipeline(Profile::timestamp() - start);
     }
 }
 
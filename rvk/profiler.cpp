@@ -0,0 +1,186 @@
+
+#include <imgui/imgui.h>
+
+#include "profiler.h"
+#include "trace.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+// Calibration is refreshed periodically to follow drift between the clocks.
+static constexpr u64 calibration_interval = 64;
+
+static u64 bit_mask(u32 bits) {
+    if(bits >= 64) return ~0ull;
+    return (1ull << bits) - 1;
+}
+
+Gpu_Profiler::Gpu_Profiler(Arc<Physical_Device, Alloc> physical_device, Arc<Device, Alloc> D,
+                           u32 frames_in_flight, u32 capacity)
+    : device(move(D)), capacity(capacity) {
+
+    ns_per_tick = physical_device->properties().device.properties.limits.timestampPeriod;
+
+    for(auto family : {Queue_Family::graphics, Queue_Family::compute, Queue_Family::transfer}) {
+        u32 bits = physical_device->timestamp_bits(device->queue_index(family));
+        valid_mask[static_cast<u8>(family)] = bits ? bit_mask(bits) : 0;
+    }
+    if(!valid_mask[static_cast<u8>(Queue_Family::graphics)]) {
+        warn("[rvk] Graphics queue does not support timestamps, GPU scopes are disabled.");
+    }
+
+    VkQueryPoolCreateInfo pool_info = {
+        .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+        .queryType = VK_QUERY_TYPE_TIMESTAMP,
+        .queryCount = capacity * 2,
+    };
+
+    for(u32 i = 0; i < frames_in_flight; i++) {
+        auto slot = Box<Slot, Alloc>::make();
+        RVK_CHECK(vkCreateQueryPool(*device, &pool_info, null, &slot->pool));
+        vkResetQueryPool(*device, slot->pool, 0, capacity * 2);
+        slot->scopes = Vec<Scope, Alloc>::make(capacity);
+        slots.push(move(slot));
+    }
+
+    calibrate();
+    if(!calibrated) {
+        info("[rvk] Calibrated timestamps are unavailable, GPU scopes will only report durations.");
+    }
+}
+
+Gpu_Profiler::~Gpu_Profiler() {
+    for(auto& slot : slots) {
+        vkDestroyQueryPool(*device, slot->pool, null);
+    }
+}
+
+void Gpu_Profiler::imgui() {
+    using namespace ImGui;
+
+    Text("Scopes per frame: %u | Dropped: %lu", capacity, dropped);
+    if(calibrated) {
+        Text("Calibration error: %.3fms", Profile::ms(calibration_error));
+    } else {
+        Text("Calibration: unavailable");
+    }
+
+    Thread::Lock lock{mutex};
+    for(auto& timing : resolved) {
+        Text("%.*s: %.3fms", static_cast<i32>(timing.name.length()), timing.name.data(),
+             timing.ms);
+    }
+}
+
+void Gpu_Profiler::begin_frame(u32 frame) {
+    if(frames++ % calibration_interval == 0) calibrate();
+    resolve(*slots[frame]);
+    current.store(frame);
+}
+
+Opt<u32> Gpu_Profiler::begin(Commands& cmds, String_View name) {
+    Queue_Family family = cmds.family();
+    if(!valid_mask[static_cast<u8>(family)]) return {};
+
+    u32 frame = static_cast<u32>(current.load());
+    Slot& slot = *slots[frame];
+
+    u64 scope = static_cast<u64>(slot.used.incr() - 1);
+    if(scope >= capacity) return {};
+
+    slot.scopes[scope] = Scope{name, family};
+    cmds.tag_queue(&slot.scopes[scope].queue);
+    vkCmdWriteTimestamp2(cmds, VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, slot.pool,
+                         static_cast<u32>(scope * 2));
+
+    return Opt{static_cast<u32>(frame * capacity + scope)};
+}
+
+void Gpu_Profiler::end(Commands& cmds, u32 query) {
+    Slot& slot = *slots[query / capacity];
+    u32 scope = query % capacity;
+    vkCmdWriteTimestamp2(cmds, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT, slot.pool, scope * 2 + 1);
+}
+
+Vec<Gpu_Timing, Alloc> Gpu_Profiler::timings() {
+    Thread::Lock lock{mutex};
+    return resolved.clone();
+}
+
+void Gpu_Profiler::calibrate() {
+    Profile::Time_Point before = Profile::timestamp();
+    auto timestamp = device->device_timestamp();
+    Profile::Time_Point after = Profile::timestamp();
+    if(!timestamp.ok()) return;
+
+    calibrated = true;
+    gpu_base = *timestamp;
+    cpu_base = before + (after - before) / 2;
+    calibration_error = (after - before) / 2;
+}
+
+void Gpu_Profiler::resolve(Slot& slot) {
+
+    u64 used = static_cast<u64>(slot.used.load());
+    if(used > capacity) {
+        dropped += used - capacity;
+        used = capacity;
+    }
+
+    Vec<Gpu_Timing, Alloc> timings(used);
+
+    if(used) Region(R) {
+        // Each query is followed by its availability. Queries of scopes that were never
+        // submitted stay unavailable and are skipped.
+        auto results = Vec<u64, Mregion<R>>::make(used * 4);
+        VkResult result =
+            vkGetQueryPoolResults(*device, slot.pool, 0, static_cast<u32>(used * 2),
+                                  results.length() * sizeof(u64), results.data(),
+                                  2 * sizeof(u64),
+                                  VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+        if(result != VK_SUCCESS && result != VK_NOT_READY) RVK_CHECK(result);
+
+        for(u64 i = 0; i < used; i++) {
+            if(!results[i * 4 + 1] || !results[i * 4 + 3]) continue;
+
+            Scope& scope = slot.scopes[i];
+            u64 mask = valid_mask[static_cast<u8>(scope.family)];
+            u64 begin = results[i * 4] & mask;
+            u64 end = results[i * 4 + 2] & mask;
+
+            timings.push(Gpu_Timing{
+                .name = scope.name,
+                .family = scope.family,
+                .queue = scope.queue,
+                .begin = calibrated ? to_cpu(begin, mask) : 0,
+                .end = calibrated ? to_cpu(end, mask) : 0,
+                .ms = static_cast<f64>((end - begin) & mask) * ns_per_tick / 1e6,
+            });
+        }
+    }
+
+    vkResetQueryPool(*device, slot.pool, 0, capacity * 2);
+    slot.used.store(0);
+
+    if(Event_Ring* ring = Event_Ring::active(); ring && calibrated) {
+        for(auto& timing : timings) {
+            ring->gpu(timing.name, timing.family, timing.queue, timing.begin, timing.end);
+        }
+    }
+
+    Thread::Lock lock{mutex};
+    resolved = move(timings);
+}
+
+Profile::Time_Point Gpu_Profiler::to_cpu(u64 ticks, u64 mask) {
+    // Results usually precede the latest calibration, so the difference may be negative.
+    u64 forward = (ticks - gpu_base) & mask;
+    f64 delta = forward > mask / 2 ? -static_cast<f64>((gpu_base - ticks) & mask)
+                                   : static_cast<f64>(forward);
+    f64 points = delta * ns_per_tick / 1e6 / Profile::ms(1);
+    return static_cast<Profile::Time_Point>(static_cast<i64>(cpu_base) +
+                                            static_cast<i64>(points));
+}
+
+} // namespace rvk::impl
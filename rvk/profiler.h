@@ -0,0 +1,96 @@
+
+#pragma once
+
+#include <rpp/base.h>
+#include <rpp/rc.h>
+
+#include "fwd.h"
+
+#include "commands.h"
+#include "device.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+// GPU time of one scope. Begin and end are on the CPU clock when the device supports
+// calibrated timestamps, and zero otherwise.
+struct Gpu_Timing {
+    String_View name;
+    Queue_Family family = Queue_Family::graphics;
+    u32 queue = 0;
+    Profile::Time_Point begin = 0;
+    Profile::Time_Point end = 0;
+    f64 ms = 0.0;
+};
+
+// Records timestamp pairs into one query pool per frame slot. A slot's results are read
+// without waiting when the slot is reused, since its commands have completed by then, and the
+// pool is then reset from the host. Scopes must therefore be recorded into commands that
+// complete within their frame.
+struct Gpu_Profiler {
+
+    ~Gpu_Profiler();
+
+    Gpu_Profiler(const Gpu_Profiler&) = delete;
+    Gpu_Profiler& operator=(const Gpu_Profiler&) = delete;
+    Gpu_Profiler(Gpu_Profiler&&) = delete;
+    Gpu_Profiler& operator=(Gpu_Profiler&&) = delete;
+
+    void imgui();
+
+    // Resolves the previous results of the slot and starts recording into it.
+    void begin_frame(u32 frame);
+
+    // Returns the query of the scope, or nothing if the slot is full or the queue family has
+    // no timestamps. The name must outlive the frame's resolution.
+    Opt<u32> begin(Commands& cmds, String_View name);
+    void end(Commands& cmds, u32 query);
+
+    // Timings of the most recently resolved frame.
+    Vec<Gpu_Timing, Alloc> timings();
+
+private:
+    explicit Gpu_Profiler(Arc<Physical_Device, Alloc> physical_device, Arc<Device, Alloc> device,
+                          u32 frames_in_flight, u32 capacity);
+    friend struct Arc<Gpu_Profiler, Alloc>;
+
+    // The queue index is written when the scope's commands are submitted.
+    struct Scope {
+        String_View name;
+        Queue_Family family = Queue_Family::graphics;
+        u32 queue = 0;
+    };
+
+    struct Slot {
+        VkQueryPool pool = null;
+        Vec<Scope, Alloc> scopes;
+        Thread::Atomic used;
+    };
+
+    void calibrate();
+    void resolve(Slot& slot);
+    Profile::Time_Point to_cpu(u64 ticks, u64 mask);
+
+    Arc<Device, Alloc> device;
+    u32 capacity = 0;
+    f64 ns_per_tick = 1.0;
+    // Timestamp bit masks, indexed by Queue_Family.
+    u64 valid_mask[4] = {};
+
+    Vec<Box<Slot, Alloc>, Alloc> slots;
+    Thread::Atomic current;
+
+    // A device timestamp and the CPU time it was sampled at, refreshed periodically.
+    bool calibrated = false;
+    u64 gpu_base = 0;
+    Profile::Time_Point cpu_base = 0;
+    Profile::Time_Point calibration_error = 0;
+    u64 frames = 0;
+
+    Thread::Mutex mutex;
+    Vec<Gpu_Timing, Alloc> resolved;
+    u64 dropped = 0;
+};
+
+} // namespace rvk::impl
@@ -2,6 +2,8 @@
 #include <imgui/imgui.h>
 
 #include "commands.h"
+#include "defrag.h"
+#include "deletion.h"
 #include "descriptors.h"
 #include "device.h"
 #include "imgui_impl_vulkan.h"
@@ -9,6 +11,8 @@
 #include "memory.h"
 #include "rvk.h"
 #include "swapchain.h"
+#include "trace.h"
+#include "upload.h"
 
 namespace rvk {
 
@@ -16,41 +20,12 @@ using namespace rpp;
 
 namespace impl {
 
-struct Deletion_Queue {
-
-    explicit Deletion_Queue() = default;
-    ~Deletion_Queue() = default;
-
-    Deletion_Queue(const Deletion_Queue&) = delete;
-    Deletion_Queue& operator=(const Deletion_Queue&) = delete;
-
-    Deletion_Queue(Deletion_Queue&& src) : deletion_queue(move(src.deletion_queue)) {
-    }
-    Deletion_Queue& operator=(Deletion_Queue&& src) {
-        assert(this != &src);
-        deletion_queue = move(src.deletion_queue);
-        return *this;
-    }
-
-    void clear() {
-        Thread::Lock lock{mutex};
-        deletion_queue.clear();
-    }
-    void push(Finalizer&& finalizer) {
-        Thread::Lock lock{mutex};
-        deletion_queue.push(move(finalizer));
-    }
-
-private:
-    Thread::Mutex mutex;
-    Vec<Finalizer, Alloc> deletion_queue;
-};
+// Frames between spike dumps, so that a run of slow frames writes one trace.
+static constexpr u64 trace_dump_cooldown = 240;
 
 struct Frame {
-    explicit Frame(Arc<Command_Pool_Manager<Queue_Family::graphics>, Alloc>& graphics_command_pool,
-                   Fence fence, Semaphore available, Semaphore complete)
-        : fence{move(fence)}, cmds{graphics_command_pool->make()}, available{move(available)},
-          complete{move(complete)} {
+    explicit Frame(Semaphore available, Semaphore complete)
+        : available{move(available)}, complete{move(complete)} {
     }
     ~Frame() = default;
 
@@ -58,12 +33,12 @@ struct Frame {
     Frame& operator=(const Frame&) = delete;
 
     Frame(Frame&& src)
-        : fence(move(src.fence)), cmds(move(src.cmds)), available(move(src.available)),
+        : value(src.value), cmds(move(src.cmds)), available(move(src.available)),
           complete(move(src.complete)), wait_for(move(src.wait_for)) {
     }
     Frame& operator=(Frame&& src) {
         assert(this != &src);
-        fence = move(src.fence);
+        value = src.value;
         cmds = move(src.cmds);
         available = move(src.available);
         complete = move(src.complete);
@@ -71,7 +46,8 @@ struct Frame {
         return *this;
     }
 
-    Fence fence;
+    // Value of the frame timeline signaled when this frame's commands complete.
+    u64 value = 0;
     Commands cmds;
     Semaphore available, complete;
 
@@ -97,17 +73,45 @@ struct Vk {
     Arc<Debug_Callback, Alloc> debug_callback;
     Arc<Physical_Device, Alloc> physical_device;
     Arc<Device, Alloc> device;
-    Arc<Device_Memory, Alloc> host_memory;
-    Vec<Arc<Device_Memory, Alloc>, Alloc> device_memories;
+    Arc<Timeline_Waiter, Alloc> timeline_waiter;
+    Arc<Memory_Pool, Alloc> host_memory;
+    Arc<Memory_Pool, Alloc> upload_memory;
+    Arc<Memory_Pool, Alloc> dynamic_memory;
+    Arc<Transient_Allocator, Alloc> transient_allocator;
+    Arc<Memory_Pool, Alloc> device_memory;
+    Map<u64, Arc<Buffer_Pool, Alloc>, Alloc> buffer_pools;
+    Thread::Mutex buffer_pools_mutex;
+    u64 buffer_pool_block = 0;
     Arc<Swapchain, Alloc> swapchain;
     Arc<Descriptor_Pool, Alloc> descriptor_pool;
     Arc<Command_Pool_Manager<Queue_Family::graphics>, Alloc> graphics_command_pool;
     Arc<Command_Pool_Manager<Queue_Family::transfer>, Alloc> transfer_command_pool;
     Arc<Command_Pool_Manager<Queue_Family::compute>, Alloc> compute_command_pool;
+    Arc<Defragmenter, Alloc> defragmenter;
+    Arc<Uploader, Alloc> uploader;
     Arc<Compositor, Alloc> compositor;
+    Arc<Gpu_Profiler, Alloc> gpu_profiler;
 
+    Timeline frame_timeline;
+    u64 frame_value = 0;
     Vec<Frame, Alloc> frames;
     Vec<Deletion_Queue, Alloc> deletion_queues;
+    Profile::Time_Point deletion_budget = 0;
+    String_View pipeline_cache;
+
+    Arc<Event_Ring, Alloc> event_ring;
+    f64 trace_spike_ms = 0.0;
+    String_View trace_path;
+    Profile::Time_Point frame_start = 0;
+    u64 frames_since_dump = trace_dump_cooldown;
+
+    // Frame command buffers are allocated from the current slot's pools between begin_frame
+    // and end_frame, and the slot's pools are only reset outside of that window.
+    Thread::Mutex frame_mutex;
+    bool frame_open = false;
+
+    // async() calls whose tasks have not completed.
+    Thread::Atomic async_work;
 
     struct State {
         bool has_imgui = false;
@@ -139,10 +143,17 @@ struct Vk {
 
     void wait_idle();
     void begin_frame();
+
+    Arc<Memory_Pool, Alloc>& memory(Heap heap);
+    Arc<Memory_Pool, Alloc> make_stream_pool(Heap heap, u64& limit, Config& config);
     void end_frame(Image_View& output);
 
     Fence make_fence();
     Semaphore make_semaphore();
+    Timeline make_timeline(u64 value);
+
+    Opt<Buffer> make_buffer(u64 size, VkBufferUsageFlags usage, Heap heap);
+    Opt<Buffer_Slice> make_slice(u64 size, VkBufferUsageFlags usage, Heap heap);
 
     Pipeline make_pipeline(Pipeline::Info info);
     Opt<Binding_Table> make_table(Commands& cmds, Pipeline& pipeline,
@@ -165,6 +176,18 @@ Vk::Vk(Config config) {
     state.has_imgui = config.imgui;
     state.frames_in_flight = config.frames_in_flight;
     state.has_validation = config.validation;
+    buffer_pool_block = config.buffer_pool_block;
+    deletion_budget = config.deletion_budget_ms > 0.0
+                          ? static_cast<Profile::Time_Point>(config.deletion_budget_ms /
+                                                             Profile::ms(1))
+                          : RPP_UINT64_MAX;
+
+    if(config.trace_events > 0) {
+        event_ring = Arc<Event_Ring, Alloc>::make(config.trace_events);
+        Event_Ring::activate(&*event_ring);
+        trace_spike_ms = config.trace_spike_ms;
+        trace_path = config.trace_path;
+    }
 
     instance =
         Arc<Instance, Alloc>::make(move(config.swapchain_extensions), move(config.layers),
@@ -175,7 +198,14 @@ Vk::Vk(Config config) {
     physical_device = instance->physical_device(instance->surface(), config.ray_tracing);
 
     device = Arc<Device, Alloc>::make(physical_device.dup(), instance->surface(),
-                                      config.ray_tracing, config.robust_accesses);
+                                      config.ray_tracing, config.robust_accesses,
+                                      config.threaded_submit, config.recycle_sync,
+                                      config.balance_queues);
+
+    timeline_waiter = Arc<Timeline_Waiter, Alloc>::make(device.dup());
+
+    pipeline_cache = config.pipeline_cache;
+    if(pipeline_cache.length()) device->load_pipeline_cache(pipeline_cache);
 
     u64 max_allocation = physical_device->max_allocation();
     {
@@ -183,16 +213,49 @@ Vk::Vk(Config config) {
         if(heap_size < Math::MB(64)) {
             die("[rvk] Host heap is too small: %mb / 64mb.", heap_size / Math::MB(1));
         }
-        if(config.host_heap > max_allocation) {
-            warn("[rvk] Requested host heap is larger than the max allocation size, using max.");
-            config.host_heap = max_allocation;
+        if(config.host_block > max_allocation) {
+            warn("[rvk] Requested host block is larger than the max allocation size, using max.");
+            config.host_block = max_allocation;
         }
         if(config.host_heap > heap_size) {
             warn("[rvk] Requested host heap is larger than available, using entire heap.");
             config.host_heap = heap_size;
         }
-        host_memory = Arc<Device_Memory, Alloc>::make(physical_device, device.dup(), Heap::host,
-                                                      config.host_heap);
+        config.host_block = Math::min(config.host_block, config.host_heap);
+        host_memory = Arc<Memory_Pool, Alloc>::make(
+            physical_device.dup(), device.dup(),
+            Memory_Pool::Config{.location = Heap::host,
+                              .block_size = config.host_block,
+                              .limit = config.host_heap,
+                              .cache_limit = config.thread_cache_limit,
+                              .dedicated_threshold = config.dedicated_threshold,
+                              .trim_frames = config.heap_trim_frames});
+    }
+    upload_memory = make_stream_pool(Heap::upload, config.upload_heap, config);
+    dynamic_memory = make_stream_pool(Heap::dynamic, config.dynamic_heap, config);
+    {
+        // With resizable BAR, per-frame data is written directly to device local memory.
+        Heap heap = device->has_rebar() ? Heap::dynamic : Heap::upload;
+        u64 limit = heap == Heap::dynamic ? config.dynamic_heap : config.upload_heap;
+        if(config.transient_heap > limit / 2) {
+            warn("[rvk] Requested transient heap is larger than half the % heap, using half.",
+                 heap);
+            config.transient_heap = limit / 2;
+        }
+        auto buffer = memory(heap)->make(config.transient_heap,
+                                         VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                                             VK_BUFFER_USAGE_TRANSFER_DST_BIT |
+                                             VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                                             VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        if(!buffer.ok()) {
+            die("[rvk] Failed to allocate transient heap of size %mb.",
+                config.transient_heap / Math::MB(1));
+        }
+        // Regions start at an offset that is valid for any uniform or storage binding.
+        u64 alignment = device->buffer_offset_alignment(VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT |
+                                                        VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+        transient_allocator = Arc<Transient_Allocator, Alloc>::make(
+            move(*buffer), config.frames_in_flight, Math::max(alignment, u64{256}));
     }
     {
         u64 heap_size = device->heap_size(Heap::device);
@@ -203,35 +266,55 @@ Vk::Vk(Config config) {
             warn("[rvk] Requested device margin is larger than available, using entire heap.");
             config.device_heap = heap_size;
         }
-
-        u64 allocated = 0;
-        u64 target = config.device_heap;
-        while(allocated < target) {
-            u64 size = Math::min(target - allocated, physical_device->max_allocation());
-            device_memories.push(
-                Arc<Device_Memory, Alloc>::make(physical_device, device.dup(), Heap::device, size));
-            allocated += size;
-        }
+        config.device_block = Math::min(config.device_block, config.device_heap);
+        config.device_block = Math::min(config.device_block, max_allocation);
+        device_memory = Arc<Memory_Pool, Alloc>::make(
+            physical_device.dup(), device.dup(),
+            Memory_Pool::Config{.location = Heap::device,
+                              .block_size = config.device_block,
+                              .limit = config.device_heap,
+                              .cache_limit = config.thread_cache_limit,
+                              .dedicated_threshold = config.dedicated_threshold,
+                              .trim_frames = config.heap_trim_frames});
     }
 
     descriptor_pool = Arc<Descriptor_Pool, Alloc>::make(device.dup(), config.descriptors_per_type,
                                                         config.ray_tracing);
 
     graphics_command_pool =
-        Arc<Command_Pool_Manager<Queue_Family::graphics>, Alloc>::make(device.dup());
+        Arc<Command_Pool_Manager<Queue_Family::graphics>, Alloc>::make(device.dup(),
+                                                                       config.frames_in_flight);
 
     transfer_command_pool =
-        Arc<Command_Pool_Manager<Queue_Family::transfer>, Alloc>::make(device.dup());
+        Arc<Command_Pool_Manager<Queue_Family::transfer>, Alloc>::make(device.dup(),
+                                                                       config.frames_in_flight);
 
     compute_command_pool =
-        Arc<Command_Pool_Manager<Queue_Family::compute>, Alloc>::make(device.dup());
+        Arc<Command_Pool_Manager<Queue_Family::compute>, Alloc>::make(device.dup(),
+                                                                      config.frames_in_flight);
+
+    uploader = Arc<Uploader, Alloc>::make(device.dup(), timeline_waiter.dup(),
+                                          transfer_command_pool.dup(), upload_memory.dup(),
+                                          config.upload_chunk);
+
+    if(config.defrag_budget > 0) {
+        defragmenter = Arc<Defragmenter, Alloc>::make(device.dup(), transfer_command_pool.dup(),
+                                                      make_timeline(0), config.defrag_budget,
+                                                      move(config.on_relocate));
+    }
+
+    if(config.gpu_scopes > 0) {
+        gpu_profiler = Arc<Gpu_Profiler, Alloc>::make(physical_device.dup(), device.dup(),
+                                                      config.frames_in_flight, config.gpu_scopes);
+    }
 
     { // Create per-frame resources
         Profile::Time_Point start = Profile::timestamp();
 
+        frame_timeline = make_timeline(0);
         frames.reserve(config.frames_in_flight);
         for(u32 i = 0; i < config.frames_in_flight; i++) {
-            frames.emplace(graphics_command_pool, make_fence(), make_semaphore(), make_semaphore());
+            frames.emplace(make_semaphore(), make_semaphore());
             deletion_queues.emplace();
         }
 
@@ -259,6 +342,8 @@ Vk::Vk(Config config) {
 Vk::~Vk() {
     wait_idle();
     destroy_imgui();
+    if(pipeline_cache.length()) static_cast<void>(device->save_pipeline_cache(pipeline_cache));
+    Event_Ring::activate(null);
 }
 
 void Vk::imgui() {
@@ -269,23 +354,68 @@ void Vk::imgui() {
     Text("Frame: %u | Image: %u", state.frame_index, state.swapchain_index);
     Text("Swapchain images: %u | Max frames: %u", swapchain->slot_count(), state.frames_in_flight);
     Text("Extent: %ux%u", swapchain->extent().width, swapchain->extent().height);
+    {
+        u64 retired = 0;
+        for(auto& queue : deletion_queues) retired += queue.retired_count();
+        Text("Retired resources: %lu", retired);
+    }
 
-    if(TreeNodeEx("Device Heaps", ImGuiTreeNodeFlags_DefaultOpen)) {
-        i32 i = 0;
-        for(auto& device_memory : device_memories) {
-            PushID(i++);
-            if(TreeNodeEx("##heap", ImGuiTreeNodeFlags_DefaultOpen, "[%d]", i)) {
-                device_memory->imgui();
-                TreePop();
-            }
-            PopID();
-        }
+    if(TreeNodeEx("Device Heap", ImGuiTreeNodeFlags_DefaultOpen)) {
+        device_memory->imgui();
         TreePop();
     }
     if(TreeNodeEx("Host Heap", ImGuiTreeNodeFlags_DefaultOpen)) {
         host_memory->imgui();
         TreePop();
     }
+    if(TreeNodeEx("Upload Heap", ImGuiTreeNodeFlags_DefaultOpen)) {
+        upload_memory->imgui();
+        TreePop();
+    }
+    if(TreeNodeEx("Dynamic Heap", ImGuiTreeNodeFlags_DefaultOpen)) {
+        dynamic_memory->imgui();
+        TreePop();
+    }
+    if(TreeNodeEx("Transient Heap", ImGuiTreeNodeFlags_DefaultOpen)) {
+        transient_allocator->imgui();
+        TreePop();
+    }
+    if(TreeNode("Uploader")) {
+        uploader->imgui();
+        TreePop();
+    }
+    if(defragmenter.ok() && TreeNode("Defragmenter")) {
+        defragmenter->imgui();
+        TreePop();
+    }
+    if(gpu_profiler.ok() && TreeNode("GPU Profiler")) {
+        gpu_profiler->imgui();
+        TreePop();
+    }
+    if(event_ring.ok() && TreeNode("Trace")) {
+        event_ring->imgui();
+        if(Button("Dump")) static_cast<void>(event_ring->dump(trace_path));
+        TreePop();
+    }
+    if(TreeNode("Buffer Pools")) {
+        Thread::Lock lock{buffer_pools_mutex};
+        for(auto& [key, pool] : buffer_pools) {
+            PushID(&*pool);
+            bool open = false;
+            Region(R) {
+                auto heap = format<Mregion<R>>("%"_v, static_cast<Heap>(key >> 32));
+                auto name = heap.view().terminate<Mregion<R>>();
+                open = TreeNodeEx("##pool", 0, "%s: 0x%x",
+                                  reinterpret_cast<const char*>(name.data()), pool->usage());
+            }
+            if(open) {
+                pool->imgui();
+                TreePop();
+            }
+            PopID();
+        }
+        TreePop();
+    }
     if(TreeNode("Device")) {
         device->imgui();
         TreePop();
@@ -338,6 +468,8 @@ void Vk::create_imgui() {
 
 void Vk::wait_idle() {
     device->wait_idle();
+    // Every upload has completed, so its staging memory can be recycled.
+    uploader->poll();
     for(auto& queue : deletion_queues) {
         queue.clear();
     }
@@ -345,17 +477,87 @@ void Vk::wait_idle() {
 
 void Vk::begin_frame() {
 
+    if(event_ring.ok()) {
+        Profile::Time_Point now = Profile::timestamp();
+        if(frame_start) {
+            event_ring->cpu("Frame"_v, frame_start, now);
+
+            // Dump on the first spike, then wait until the ring holds mostly new events.
+            frames_since_dump++;
+            if(trace_spike_ms > 0.0 && frames_since_dump > trace_dump_cooldown &&
+               Profile::ms(now - frame_start) > trace_spike_ms) {
+                warn("[rvk] Frame took %ms, dumping trace.", Profile::ms(now - frame_start));
+                static_cast<void>(event_ring->dump(trace_path));
+                frames_since_dump = 0;
+            }
+        }
+        frame_start = now;
+    }
+
+    Event_Scope scope{"Begin frame"_v};
+
     state.resized_last_frame = false;
 
     // If we wrapped all the way around the in flight frames and got to a frame that
     // is still executing, wait for it to finish so we can free/reuse its resources.
     Trace("Wait for frame slot") {
-        frames[state.frame_index].fence.wait();
+        frame_timeline.wait(frames[state.frame_index].value);
     }
 
-    // Erase resources dropped while this frame was in flight
+    // Resources dropped while this frame was in flight can be destroyed now. Destruction is
+    // spread over frames by the budget; retired resources stay safe to destroy later.
     Trace("Erase dropped resources") {
-        deletion_queues[state.frame_index].clear();
+        Event_Scope flush{"Flush deletion queue"_v};
+        deletion_queues[state.frame_index].retire();
+        Profile::Time_Point start = Profile::timestamp();
+        Profile::Time_Point deadline =
+            deletion_budget > RPP_UINT64_MAX - start ? RPP_UINT64_MAX : start + deletion_budget;
+        for(auto& queue : deletion_queues) {
+            if(queue.destroy(deadline)) break;
+        }
+    }
+
+    // Transient allocations made in this slot's previous frame are no longer in use
+    transient_allocator->reset(state.frame_index);
+
+    // Neither are the slot's frame command buffers, so their pools are reset as a whole
+    Trace("Reset frame command pools") {
+        Thread::Lock lock{frame_mutex};
+        graphics_command_pool->reset_frame(state.frame_index);
+        transfer_command_pool->reset_frame(state.frame_index);
+        compute_command_pool->reset_frame(state.frame_index);
+        frame_open = true;
+    }
+
+    // The slot's timestamp queries have completed too
+    if(gpu_profiler.ok()) {
+        Trace("Resolve GPU timestamps") {
+            gpu_profiler->begin_frame(state.frame_index);
+        }
+    }
+
+    // Recycle staging memory of completed uploads
+    uploader->poll();
+
+    // Free heap blocks that have been empty for a while
+    Trace("Trim heaps") {
+        device_memory->trim();
+        host_memory->trim();
+        upload_memory->trim();
+        dynamic_memory->trim();
+    }
+
+    // Compact device heaps. Images can only move while no other frame, async() call, or
+    // upload is in flight.
+    if(defragmenter.ok()) {
+        bool idle = frame_timeline.ready(frame_value) && async_work.load() == 0 &&
+                    uploader->idle();
+        Trace("Defragment heaps") {
+            auto heaps = device_memory->blocks();
+            if(auto wait = defragmenter->step(heaps.slice(), idle); wait.ok()) {
+                frames[state.frame_index].wait(*wait);
+            }
+        }
     }
 
     if(state.has_imgui) {
@@ -371,11 +573,12 @@ void Vk::begin_frame() {
     // is not considered available until the present to it completes, so there is an
     // implicit sync between here and vkQueuePresentKHR in end_frame.
     // Total frame syncs:
-    //  frame fence --> user commands -|barrier
+    //  timeline    --> user commands -|barrier
     //                                 v
     //         img acq -frame.avail->  x  -frame.finish-> presentation -implicit-> img acq
     VkResult result;
     Trace("Acquire next image") {
+        Event_Scope acquire{"Acquire"_v};
         result = vkAcquireNextImageKHR(*device, *swapchain, RPP_UINT64_MAX,
                                        frames[state.frame_index].available, null,
                                        &state.swapchain_index);
@@ -403,6 +606,8 @@ void Vk::begin_frame() {
 
 void Vk::end_frame(Image_View& output) {
 
+    Event_Scope scope{"End frame"_v};
+
     if(state.has_imgui) {
         ImGui::Render();
     }
@@ -418,7 +623,7 @@ void Vk::end_frame(Image_View& output) {
     // Send frame to GPU queues
     {
         // Set up primary compositing command buffer
-        frame.cmds.reset();
+        frame.cmds = graphics_command_pool->make_frame(state.frame_index);
         compositor->render(frame.cmds, state.frame_index, state.swapchain_index, state.has_imgui,
                            state.is_hdr, output);
         frame.cmds.end();
@@ -426,8 +631,12 @@ void Vk::end_frame(Image_View& output) {
         // Wait for frame available before running the submit; signal frame complete on finish
         frame.wait(Sem_Ref{frame.available, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT});
 
-        auto signal = Sem_Ref{frame.complete, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT};
-        device->submit(frame.cmds, 0, Slice{signal}, frame.waits(), frame.fence);
+        frame.value = ++frame_value;
+        Sem_Ref signals[] = {
+            Sem_Ref{frame.complete, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT},
+            Sem_Ref{frame_timeline, frame.value, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT},
+        };
+        device->submit(frame.cmds, 0, frame.waits(), Slice{signals, 2});
 
         frame.clear();
     }
@@ -446,7 +655,11 @@ void Vk::end_frame(Image_View& output) {
     };
 
     // Submit presentation command
-    VkResult result = device->present(present_info);
+    VkResult result;
+    {
+        Event_Scope present{"Present"_v};
+        result = device->present(present_info);
+    }
     if(result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR) {
         recreate_swapchain();
     } else if(result != VK_SUCCESS) {
@@ -461,6 +674,8 @@ void Vk::end_frame(Image_View& output) {
     }
 
     // Circular increment of in-flight frame index
+    Thread::Lock lock{frame_mutex};
+    frame_open = false;
     state.advance();
 }
 
@@ -497,29 +712,93 @@ void Vk::recreate_swapchain() {
 }
 
 Fence Vk::make_fence() {
-    return Fence{device.dup()};
+    return Fence{device.dup(), timeline_waiter.dup()};
 }
 
 Semaphore Vk::make_semaphore() {
-    return Semaphore{device.dup()};
+    return Semaphore{device.dup(), true};
 }
 
-Opt<TLAS::Buffers> Vk::make_tlas(u32 instances) {
-    for(auto& device_memory : device_memories) {
-        if(auto tlas = TLAS::make(device_memory, instances); tlas.ok()) {
-            return tlas;
-        }
+Timeline Vk::make_timeline(u64 value) {
+    return Timeline{device.dup(), timeline_waiter.dup(), value};
+}
+
+Arc<Memory_Pool, Alloc>& Vk::memory(Heap heap) {
+    switch(heap) {
+    case Heap::device: return device_memory;
+    case Heap::host: return host_memory;
+    case Heap::upload: return upload_memory;
+    case Heap::dynamic: return dynamic_memory;
+    default: RPP_UNREACHABLE;
     }
-    return {};
 }
 
-Opt<BLAS::Buffers> Vk::make_blas(Slice<const BLAS::Size> sizes) {
-    for(auto& device_memory : device_memories) {
-        if(auto blas = BLAS::make(device_memory, sizes); blas.ok()) {
-            return blas;
+Arc<Memory_Pool, Alloc> Vk::make_stream_pool(Heap heap, u64& limit, Config& config) {
+    u64 heap_size = device->heap_size(heap);
+    if(limit > heap_size) {
+        warn("[rvk] Requested % heap is larger than available, using entire heap.", heap);
+        limit = heap_size;
+    }
+    u64 block_size = Math::min(config.stream_block, limit);
+    block_size = Math::min(block_size, physical_device->max_allocation());
+    return Arc<Memory_Pool, Alloc>::make(
+        physical_device.dup(), device.dup(),
+        Memory_Pool::Config{.location = heap,
+                            .block_size = block_size,
+                            .limit = limit,
+                            .cache_limit = config.thread_cache_limit,
+                            .dedicated_threshold = config.dedicated_threshold,
+                            .trim_frames = config.heap_trim_frames});
+}
+
+Opt<Buffer> Vk::make_buffer(u64 size, VkBufferUsageFlags usage, Heap heap) {
+    return memory(heap)->make(size, usage);
+}
+
+Opt<Buffer_Slice> Vk::make_slice(u64 size, VkBufferUsageFlags usage, Heap heap) {
+
+    if(size > buffer_pool_block) {
+        warn("[rvk] Requested buffer slice is larger than the pool block size.");
+        return {};
+    }
+
+    if(heap == Heap::device || heap == Heap::dynamic) {
+        usage |= VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
+    }
+
+    Arc<Buffer_Pool, Alloc> pool;
+    {
+        Thread::Lock lock{buffer_pools_mutex};
+        u64 key = static_cast<u64>(heap) << 32 | usage;
+        if(!buffer_pools.contains(key)) {
+            buffer_pools.insert(key, Arc<Buffer_Pool, Alloc>::make(
+                                         usage, buffer_pool_block,
+                                         device->buffer_offset_alignment(usage)));
         }
+        pool = buffer_pools.get(key).dup();
     }
-    return {};
+
+    if(auto slice = pool->make(size); slice.ok()) {
+        return slice;
+    }
+
+    auto block = make_buffer(buffer_pool_block, usage, heap);
+    if(!block.ok()) return {};
+
+    pool->grow(move(*block));
+    return pool->make(size);
+}
+
+Opt<TLAS::Buffers> Vk::make_tlas(u32 instances) {
+    return device_memory->make<TLAS::Buffers>(0, [&](Arc<Device_Memory, Alloc>& memory) {
+        return TLAS::make(memory, instances);
+    });
+}
+
+Opt<BLAS::Buffers> Vk::make_blas(Slice<const BLAS::Size> sizes) {
+    return device_memory->make<BLAS::Buffers>(0, [&](Arc<Device_Memory, Alloc>& memory) {
+        return BLAS::make(memory, sizes);
+    });
 }
 
 TLAS Vk::build_tlas(Commands& cmds, TLAS::Buffers tlas, Buffer gpu_instances,
@@ -541,10 +820,6 @@ Opt<Binding_Table> Vk::make_table(Commands& cmds, Pipeline& pipeline,
     return Binding_Table::make(singleton->device.dup(), cmds, pipeline, move(mapping));
 }
 
-bool validation_enabled() {
-    return singleton->state.has_validation;
-}
-
 Arc<Device, Alloc> get_device() {
     return singleton->device.dup();
 }
@@ -633,6 +908,22 @@ void drop(Finalizer f) {
     impl::singleton->deletion_queues[impl::singleton->state.frame_index].push(move(f));
 }
 
+void drop(Buffer buffer) {
+    impl::singleton->deletion_queues[impl::singleton->state.frame_index].push(move(buffer));
+}
+
+void drop(Image image) {
+    impl::singleton->deletion_queues[impl::singleton->state.frame_index].push(move(image));
+}
+
+void drop(Image_View view) {
+    impl::singleton->deletion_queues[impl::singleton->state.frame_index].push(move(view));
+}
+
+void drop(Descriptor_Set set) {
+    impl::singleton->deletion_queues[impl::singleton->state.frame_index].push(move(set));
+}
+
 Fence make_fence() {
     return impl::singleton->make_fence();
 }
@@ -641,6 +932,26 @@ Semaphore make_semaphore() {
     return impl::singleton->make_semaphore();
 }
 
+Timeline make_timeline(u64 value) {
+    return impl::singleton->make_timeline(value);
+}
+
+Commands make_secondary(const Rendering_Formats& formats) {
+    return impl::singleton->graphics_command_pool->make_secondary(formats);
+}
+
+Commands make_frame_commands(Queue_Family family) {
+    Thread::Lock lock{impl::singleton->frame_mutex};
+    assert(impl::singleton->frame_open);
+    u32 frame = impl::singleton->state.frame_index;
+    switch(family) {
+    case Queue_Family::graphics: return impl::singleton->graphics_command_pool->make_frame(frame);
+    case Queue_Family::transfer: return impl::singleton->transfer_command_pool->make_frame(frame);
+    case Queue_Family::compute: return impl::singleton->compute_command_pool->make_frame(frame);
+    default: RPP_UNREACHABLE;
+    }
+}
+
 Commands make_commands(Queue_Family family) {
     switch(family) {
     case Queue_Family::graphics: return impl::singleton->graphics_command_pool->make();
@@ -655,28 +966,67 @@ Opt<Buffer> make_staging(u64 size) {
                                                         VK_BUFFER_USAGE_TRANSFER_DST_BIT);
 }
 
+Opt<Transient> make_transient(u64 size, u64 alignment) {
+    if(auto transient = impl::singleton->transient_allocator->allocate(size, alignment);
+       transient.ok()) {
+        return transient;
+    }
+
+    // Out of transient space: fall back to a staging buffer with the same lifetime
+    auto staging = make_staging(size);
+    if(!staging.ok()) return {};
+
+    Transient transient{*staging, 0, size, staging->map()};
+    drop(move(*staging));
+    return Opt{transient};
+}
+
 Opt<Buffer> make_buffer(u64 size, VkBufferUsageFlags usage) {
-    for(auto& device_memory : impl::singleton->device_memories) {
-        if(auto buf = device_memory->make(size, usage); buf.ok()) {
-            return buf;
-        }
+    return impl::singleton->make_buffer(size, usage, Heap::device);
+}
+
+Opt<Buffer> make_buffer(u64 size, VkBufferUsageFlags usage, Intent intent) {
+    switch(intent) {
+    case Intent::gpu_only: return impl::singleton->make_buffer(size, usage, Heap::device);
+    case Intent::upload: return impl::singleton->make_buffer(size, usage, Heap::upload);
+    case Intent::readback: return impl::singleton->make_buffer(size, usage, Heap::host);
+    case Intent::dynamic: return impl::singleton->make_buffer(size, usage, Heap::dynamic);
+    default: RPP_UNREACHABLE;
     }
-    return {};
+}
+
+Opt<Buffer_Slice> make_slice(u64 size, VkBufferUsageFlags usage, Heap heap) {
+    return impl::singleton->make_slice(size, usage, heap);
 }
 
 Opt<Image> make_image(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage) {
-    for(auto& device_memory : impl::singleton->device_memories) {
-        if(auto img = device_memory->make(extent, format, usage); img.ok()) {
-            return img;
-        }
-    }
-    return {};
+    return impl::singleton->device_memory->make(extent, format, usage);
 }
 
 Sampler make_sampler(Sampler::Config config) {
     return Sampler{impl::singleton->device.dup(), config};
 }
 
+Opt<u64> upload(Slice<const u8> data, Buffer& dst, u64 dst_offset) {
+    return impl::singleton->uploader->enqueue(data, dst, dst_offset);
+}
+
+Opt<u64> upload(Slice<const u8> data, Image& dst, VkImageLayout layout) {
+    return impl::singleton->uploader->enqueue(data, dst, layout);
+}
+
+Opt<Sem_Ref> submit_uploads() {
+    return impl::singleton->uploader->submit();
+}
+
+bool upload_complete(u64 ticket) {
+    return impl::singleton->uploader->complete(ticket);
+}
+
+Async::Task<void> wait_upload(Async::Pool<>& pool, u64 ticket) {
+    return impl::singleton->uploader->wait(pool, ticket);
+}
+
 Opt<TLAS::Buffers> make_tlas(u32 instances) {
     return impl::singleton->make_tlas(instances);
 }
@@ -712,10 +1062,53 @@ void submit(Commands& cmds, u32 index, Slice<const Sem_Ref> wait, Slice<const Se
     impl::singleton->device->submit(cmds, index, wait, signal, fence);
 }
 
+void submit(Submit_Batch& batch) {
+    impl::singleton->device->submit(batch);
+}
+
+u32 submit_balanced(Commands& cmds, Slice<const Sem_Ref> wait, Slice<const Sem_Ref> signal) {
+    return impl::singleton->device->submit_balanced(cmds, wait, signal);
+}
+
 Pipeline make_pipeline(impl::Pipeline::Info info) {
     return impl::singleton->make_pipeline(move(info));
 }
 
+Async::Task<Pipeline> make_pipeline_async(Async::Pool<>& pool, impl::Pipeline::Info info) {
+    co_await pool.suspend();
+    co_return make_pipeline(move(info));
+}
+
+Async::Task<Vec<Pipeline, Alloc>> make_pipelines(Async::Pool<>& pool,
+                                                 Slice<const impl::Pipeline::Info> infos) {
+    Vec<Async::Task<Pipeline>, Alloc> tasks(infos.length());
+    for(auto& info : infos) {
+        tasks.push(make_pipeline_async(pool, info));
+    }
+
+    Vec<Pipeline, Alloc> pipelines(infos.length());
+    for(auto& task : tasks) {
+        pipelines.push(co_await task);
+    }
+    co_return pipelines;
+}
+
+Pending_Pipeline::Pending_Pipeline(Async::Task<Pipeline> task, Pipeline& placeholder)
+    : task(move(task)), placeholder(placeholder) {
+}
+
+bool Pending_Pipeline::ready() {
+    if(!compiled && task.done()) {
+        pipeline = move(task.block());
+        compiled = true;
+    }
+    return compiled;
+}
+
+Pipeline& Pending_Pipeline::get() {
+    return ready() ? pipeline : *placeholder;
+}
+
 Opt<Binding_Table> make_table(Commands& cmds, impl::Pipeline& pipeline,
                               Binding_Table::Mapping mapping) {
     return impl::singleton->make_table(cmds, pipeline, mapping);
@@ -734,4 +1127,151 @@ Box<Shader_Loader, Alloc> make_shader_loader() {
     return Box<Shader_Loader, Alloc>::make(impl::singleton->device.dup());
 }
 
+Box<Graph, Alloc> make_graph() {
+    return Box<Graph, Alloc>::make(impl::singleton->device.dup(),
+                                   impl::singleton->device_memory.dup(),
+                                   impl::singleton->make_timeline(0),
+                                   impl::singleton->make_timeline(0),
+                                   impl::singleton->state.frames_in_flight);
+}
+
+Gpu_Scope::Gpu_Scope(Commands& cmds, String_View name) : cmds(cmds) {
+    if(impl::singleton->gpu_profiler.ok()) {
+        query = impl::singleton->gpu_profiler->begin(cmds, name);
+    }
+}
+
+Gpu_Scope::~Gpu_Scope() {
+    if(query.ok()) {
+        impl::singleton->gpu_profiler->end(cmds, *query);
+    }
+}
+
+static thread_local Batch_Scope* batch_scope = null;
+
+Batch_Scope::Batch_Scope()
+    : state_(Arc<impl::Batch_State, Alloc>::make()), previous(batch_scope),
+      owner(Thread::this_id()) {
+    batch_scope = this;
+}
+
+Batch_Scope::~Batch_Scope() {
+    assert(batch_scope == this);
+    flush();
+    batch_scope = previous;
+}
+
+Batch_Scope* Batch_Scope::current() {
+    return batch_scope;
+}
+
+Arc<impl::Batch_State, Alloc> Batch_Scope::state() {
+    return state_.dup();
+}
+
+u64 Batch_Scope::add(Commands cmds, u32 index) {
+    assert(Thread::this_id() == owner);
+    Thread::Lock lock{state_->mutex};
+    u8 i = static_cast<u8>(cmds.family());
+    if(!state_->timelines[i]) {
+        state_->timelines[i] = make_timeline(0);
+        state_->values[i] = 1;
+    }
+    if(!state_->pending[i].empty() && state_->indices[i] != index) state_->close(i);
+    state_->indices[i] = index;
+    state_->pending[i].push(move(cmds));
+    return state_->values[i];
+}
+
+void Batch_Scope::flush() {
+    assert(Thread::this_id() == owner);
+    impl::Event_Scope scope{"Flush batch"_v};
+
+    u64 targets[4] = {};
+    {
+        Thread::Lock lock{state_->mutex};
+        for(u8 i = 0; i < 4; i++) {
+            if(!state_->pending[i].empty()) state_->close(i);
+            if(state_->timelines[i]) targets[i] = state_->values[i] - 1;
+        }
+    }
+    for(u8 i = 0; i < 4; i++) {
+        if(targets[i]) state_->timelines[i].wait(targets[i]);
+    }
+
+    // Batches are only submitted while they have pending commands, so none can have been
+    // added by a task since.
+    Thread::Lock lock{state_->mutex};
+    state_->in_flight.clear();
+}
+
+namespace impl {
+
+void Batch_State::close(u8 i) {
+    Submit_Batch batch;
+    Sem_Ref signal{timelines[i], values[i], VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT};
+    u64 last = pending[i].length() - 1;
+    for(u64 j = 0; j < last; j++) {
+        batch.add(pending[i][j], indices[i]);
+    }
+    batch.add(pending[i][last], indices[i], {}, Slice{&signal, 1});
+    rvk::submit(batch);
+
+    for(auto& cmds : pending[i]) {
+        in_flight.push(move(cmds));
+    }
+    pending[i].clear();
+    values[i]++;
+}
+
+void Batch_State::submit(Queue_Family family, u64 value) {
+    Thread::Lock lock{mutex};
+    u8 i = static_cast<u8>(family);
+    if(values[i] == value && !pending[i].empty()) close(i);
+}
+
+Async::Event Batch_State::event(Queue_Family family, u64 value) {
+    return timelines[static_cast<u8>(family)].event(value);
+}
+
+Async_Work::Async_Work() : active(true) {
+    singleton->async_work.incr();
+}
+
+Async_Work::~Async_Work() {
+    if(active) singleton->async_work.decr();
+    active = false;
+}
+
+Async_Work::Async_Work(Async_Work&& src) : active(src.active) {
+    src.active = false;
+}
+
+Async::Task<void> await_batch(Async::Pool<>& pool, Async_Work work,
+                              Arc<Batch_State, Alloc> state, Queue_Family family, u64 value) {
+    // The batch is submitted from a pool thread if the scope has not submitted it yet, so the
+    // task completes even if the scope's thread awaits it.
+    co_await pool.suspend();
+    state->submit(family, value);
+    co_await pool.event(state->event(family, value));
+    co_return;
+}
+
+} // namespace impl
+
+bool save_pipeline_cache() {
+    if(!impl::singleton->pipeline_cache.length()) return false;
+    return impl::singleton->device->save_pipeline_cache(impl::singleton->pipeline_cache);
+}
+
+bool dump_trace(String_View path) {
+    if(!impl::singleton->event_ring.ok()) return false;
+    return impl::singleton->event_ring->dump(path);
+}
+
+Vec<Gpu_Timing, Alloc> gpu_timings() {
+    if(!impl::singleton->gpu_profiler.ok()) return {};
+    return impl::singleton->gpu_profiler->timings();
+}
+
 } // namespace rvk
@@ -9,11 +9,16 @@
 #include "acceleration.h"
 #include "bindings.h"
 #include "commands.h"
+#include "defrag.h"
 #include "descriptors.h"
 #include "drop.h"
+#include "graph.h"
 #include "memory.h"
 #include "pipeline.h"
+#include "profiler.h"
 #include "shader_loader.h"
+#include "trace.h"
+#include "upload.h"
 
 namespace rvk {
 
@@ -21,8 +26,6 @@ using namespace rpp;
 
 // Setup
 
-using Finalizer = FunctionN<16, void()>;
-
 struct Config {
     bool validation = true;
     bool robust_accesses = true;
@@ -37,8 +40,50 @@ struct Config {
     Slice<const String_View> swapchain_extensions;
     Function<VkSurfaceKHR(VkInstance)> create_surface;
 
+    // Heaps start with one block and grow on demand up to these limits.
     u64 host_heap = Math::GB(1);
     u64 device_heap = Math::MB(4094);
+    u64 upload_heap = Math::MB(256);
+    u64 dynamic_heap = Math::MB(256);
+    u64 host_block = Math::MB(128);
+    u64 device_block = Math::MB(256);
+    u64 stream_block = Math::MB(64);
+    u32 heap_trim_frames = 240;
+    u64 thread_cache_limit = 65536;
+    u64 transient_heap = Math::MB(64);
+    u64 buffer_pool_block = Math::MB(8);
+    u64 dedicated_threshold = Math::MB(64);
+
+    u64 upload_chunk = Math::MB(16);
+
+    // Time spent destroying dropped resources per frame; the rest carries over to later frames.
+    // Zero destroys everything each frame.
+    f64 deletion_budget_ms = 0.5;
+
+    // Submit from one thread per queue instead of the calling thread.
+    bool threaded_submit = false;
+
+    // Reuse released fences and semaphores instead of destroying them.
+    bool recycle_sync = true;
+
+    // Track pending work per queue for submit_balanced. Each submission then also signals a
+    // timeline semaphore; without it, submit_balanced always uses the first queue.
+    bool balance_queues = false;
+
+    // Loaded at startup and saved at shutdown if set.
+    String_View pipeline_cache;
+
+    u64 defrag_budget = Math::MB(16);
+    Function<void(const Relocation&)> on_relocate = [](const Relocation&) {};
+
+    // Timestamp scopes recorded per frame; zero disables GPU profiling.
+    u32 gpu_scopes = 256;
+
+    // Events kept for trace dumps; zero disables tracing. When a frame takes longer than the
+    // spike threshold, the trace is written to trace_path. Zero disables spike dumps.
+    u64 trace_events = 65536;
+    f64 trace_spike_ms = 0.0;
+    String_View trace_path = "rvk-trace.json"_v;
 };
 
 bool startup(Config config);
@@ -66,17 +111,37 @@ void end_frame(Image_View& output);
 
 // Resources
 
-void drop(Finalizer f);
-
 Fence make_fence();
+// Semaphores are recycled when destroyed, so every signal must have been waited on by then.
 Semaphore make_semaphore();
+Timeline make_timeline(u64 value = 0);
 Commands make_commands(Queue_Family family = Queue_Family::graphics);
+Commands make_secondary(const Rendering_Formats& formats);
+// Frame command buffers are cheaper to allocate, but must be made, recorded, and submitted
+// between begin_frame and end_frame, and not used after it. They can't be reset individually.
+Commands make_frame_commands(Queue_Family family = Queue_Family::graphics);
 
 Opt<Buffer> make_staging(u64 size);
+// Must not be called concurrently with begin_frame.
+Opt<Transient> make_transient(u64 size, u64 alignment = 16);
 Opt<Buffer> make_buffer(u64 size, VkBufferUsageFlags usage);
+Opt<Buffer> make_buffer(u64 size, VkBufferUsageFlags usage, Intent intent);
+Opt<Buffer_Slice> make_slice(u64 size, VkBufferUsageFlags usage, Heap heap = Heap::device);
 Opt<Image> make_image(VkExtent3D extent, VkFormat format, VkImageUsageFlags usage);
 Sampler make_sampler(Sampler::Config config);
 
+// Uploads
+
+// Stages data for a copy on the transfer queue and returns the ticket of the batch that will
+// carry it. The destination must stay alive until the batch completes.
+Opt<u64> upload(Slice<const u8> data, Buffer& dst, u64 dst_offset = 0);
+Opt<u64> upload(Slice<const u8> data, Image& dst,
+                VkImageLayout layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+// Submits staged uploads; pass the result to wait_frame to use them in the current frame.
+Opt<Sem_Ref> submit_uploads();
+bool upload_complete(u64 ticket);
+Async::Task<void> wait_upload(Async::Pool<>& pool, u64 ticket);
+
 Opt<TLAS::Buffers> make_tlas(u32 instances);
 Opt<BLAS::Buffers> make_blas(Slice<const BLAS::Size> sizes);
 
@@ -104,10 +169,69 @@ void write_set(Descriptor_Set& set, u32 frame_index, Binds&... binds);
 
 Box<Shader_Loader, Alloc> make_shader_loader();
 
+// Graphs are independent of each other; each keeps its own schedule and transient images.
+Box<Graph, Alloc> make_graph();
+
 Pipeline make_pipeline(Pipeline::Info info);
+// Compiles the pipeline on a pool thread. Each thread creates pipelines through its own view of
+// the device's pipeline cache, which are merged when the cache is saved. Everything the info
+// points to must remain valid until the task completes.
+Async::Task<Pipeline> make_pipeline_async(Async::Pool<>& pool, Pipeline::Info info);
+// Compiles the pipelines in parallel on the pool and returns them in order.
+Async::Task<Vec<Pipeline, Alloc>> make_pipelines(Async::Pool<>& pool,
+                                                 Slice<const Pipeline::Info> infos);
+
+// A pipeline compiling on a pool. Until it is ready, get() returns the placeholder, e.g. a
+// simpler variant, so rendering can proceed. The placeholder must outlive the compilation.
+struct Pending_Pipeline {
+    explicit Pending_Pipeline(Async::Task<Pipeline> task, Pipeline& placeholder);
+    ~Pending_Pipeline() = default;
+
+    Pending_Pipeline(const Pending_Pipeline&) = delete;
+    Pending_Pipeline& operator=(const Pending_Pipeline&) = delete;
+    Pending_Pipeline(Pending_Pipeline&&) = default;
+    Pending_Pipeline& operator=(Pending_Pipeline&&) = default;
+
+    bool ready();
+    Pipeline& get();
+
+private:
+    Async::Task<Pipeline> task;
+    Ref<Pipeline> placeholder;
+    Pipeline pipeline;
+    bool compiled = false;
+};
+
+// Writes the pipeline cache to Config::pipeline_cache; it is also written at shutdown.
+bool save_pipeline_cache();
 
 Opt<Binding_Table> make_table(Commands& cmds, Pipeline& pipeline, Binding_Table::Mapping mapping);
 
+// Profiling
+
+// Times the commands recorded into cmds during its lifetime. Does nothing if GPU profiling is
+// disabled or the frame's scopes are exhausted. The name must outlive the frame.
+struct Gpu_Scope {
+    explicit Gpu_Scope(Commands& cmds, String_View name);
+    ~Gpu_Scope();
+
+    Gpu_Scope(const Gpu_Scope&) = delete;
+    Gpu_Scope& operator=(const Gpu_Scope&) = delete;
+    Gpu_Scope(Gpu_Scope&&) = delete;
+    Gpu_Scope& operator=(Gpu_Scope&&) = delete;
+
+private:
+    Commands& cmds;
+    Opt<u32> query;
+};
+
+// Scope timings of the most recent frame whose commands have completed.
+Vec<Gpu_Timing, Alloc> gpu_timings();
+
+// Writes recent CPU and GPU events to path as Chrome trace JSON, with one track per thread and
+// one per queue. Returns false if tracing is disabled or the file can't be written.
+bool dump_trace(String_View path);
+
 // Command execution
 
 void submit(Commands& cmds, u32 index);
@@ -115,6 +239,81 @@ void submit(Commands& cmds, u32 index, Fence& fence);
 void submit(Commands& cmds, u32 index, Slice<const Sem_Ref> wait, Slice<const Sem_Ref> signal);
 void submit(Commands& cmds, u32 index, Slice<const Sem_Ref> wait, Slice<const Sem_Ref> signal,
             Fence& fence);
+void submit(Submit_Batch& batch);
+// Submits to the queue of the command buffer's family with the least work in flight, and returns
+// the chosen queue index. Requires Config::balance_queues.
+u32 submit_balanced(Commands& cmds, Slice<const Sem_Ref> wait = {},
+                    Slice<const Sem_Ref> signal = {});
+
+namespace impl {
+// The batches of a Batch_Scope, shared with the tasks of its async() calls.
+struct Batch_State {
+    // Submits the family's batch if it is still collecting the commands that signal value.
+    void submit(Queue_Family family, u64 value);
+    Async::Event event(Queue_Family family, u64 value);
+
+    Thread::Mutex mutex;
+    // Indexed by Queue_Family. Each family's timeline reaches value when its collecting batch
+    // completes, and the batch goes to the queue of the given index.
+    Vec<Commands, Alloc> pending[4];
+    u32 indices[4] = {};
+    Timeline timelines[4];
+    u64 values[4] = {};
+    Vec<Commands, Alloc> in_flight;
+
+    // Called with the mutex held.
+    void close(u8 family);
+};
+
+// Counts an async() call as outstanding from recording until its task completes or is
+// destroyed, so that the defragmenter does not move images it may use.
+struct Async_Work {
+    Async_Work();
+    ~Async_Work();
+
+    Async_Work(const Async_Work&) = delete;
+    Async_Work& operator=(const Async_Work&) = delete;
+    Async_Work(Async_Work&& src);
+    Async_Work& operator=(Async_Work&&) = delete;
+
+private:
+    bool active = false;
+};
+} // namespace impl
+
+// Coalesces the sync() and async() calls made on this thread during its lifetime: each call
+// records and ends its own command buffer, and the buffers of a queue are submitted together
+// with one vkQueueSubmit2. A sync() call returns without submitting or waiting: its work, and
+// any results that depend on it, are only complete once the scope is flushed or closes. An
+// async() task submits its batch when the pool first runs it, unless the scope has by then,
+// so awaiting it can't deadlock, and calls made before then share the submission. Calls in a
+// batch are not separated by barriers, so f must record any it depends on. A scope is bound
+// to the thread that created it and must not be held across a suspension point. Scopes may be
+// nested.
+struct Batch_Scope {
+    Batch_Scope();
+    ~Batch_Scope();
+
+    Batch_Scope(const Batch_Scope&) = delete;
+    Batch_Scope& operator=(const Batch_Scope&) = delete;
+    Batch_Scope(Batch_Scope&&) = delete;
+    Batch_Scope& operator=(Batch_Scope&&) = delete;
+
+    // Submits everything collected so far and waits for it to complete.
+    void flush();
+
+    // Used by sync() and async(). Adds ended commands to the batch of their family and returns
+    // the timeline value reached when it completes. A batch goes to one queue, so commands for
+    // another queue of the family submit the collected batch first.
+    static Batch_Scope* current();
+    u64 add(Commands cmds, u32 index);
+    Arc<impl::Batch_State, Alloc> state();
+
+private:
+    Arc<impl::Batch_State, Alloc> state_;
+    Batch_Scope* previous = null;
+    Thread::Id owner;
+};
 
 template<typename F>
     requires Invocable<F, Commands&>
@@ -126,6 +325,14 @@ template<typename F>
 auto async(Async::Pool<>& pool, F&& f, Queue_Family family = Queue_Family::graphics,
            u32 index = 0) -> Async::Task<Invoke_Result<F, Commands&>>;
 
+// Begins dynamic rendering on cmds, records count secondary command buffers in parallel on the
+// pool by calling f(secondary, i) concurrently, executes them in order, and ends rendering. The
+// rendering info and formats must remain valid until the task completes.
+template<typename F>
+    requires Invocable<F, Commands&, u64>
+auto render_parallel(Async::Pool<>& pool, Commands& cmds, VkRenderingInfo info,
+                     Rendering_Formats formats, u64 count, F f) -> Async::Task<void>;
+
 } // namespace rvk
 
 #include "execute.h"
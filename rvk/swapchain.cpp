@@ -16,7 +16,8 @@ static Pipeline::Info compositor_pipeline_info(Arc<Swapchain, Alloc>& swapchain,
                                                Descriptor_Set_Layout& layout, Shader& v, Shader& f);
 static Slice<const VkDescriptorSetLayoutBinding> compositor_ds_layout();
 
-static void swapchain_image_setup(Commands& commands, VkImage image);
+template<typename A>
+static void swapchain_image_setup(Barriers<A>& barriers, VkImage image);
 static VkImageView swapchain_image_view(VkDevice device, VkImage image, VkFormat format);
 
 Swapchain::Swapchain(Commands& cmds, Arc<Physical_Device, Alloc>& physical_device,
@@ -106,11 +107,13 @@ Swapchain::Swapchain(Commands& cmds, Arc<Physical_Device, Alloc>& physical_devic
             }
             info("[rvk] Got % swapchain images.", n_images);
 
+            Barriers<Mregion<R>> barriers;
             for(u32 i = 0; i < n_images; i++) {
                 auto view = swapchain_image_view(*device, image_data[i], surface_format.format);
                 slots.emplace(image_data[i], view);
-                swapchain_image_setup(cmds, image_data[i]);
+                swapchain_image_setup(barriers, image_data[i]);
             }
+            barriers.flush(cmds, VK_DEPENDENCY_BY_REGION_BIT);
         }
     }
 
@@ -550,37 +553,19 @@ static VkImageView swapchain_image_view(VkDevice device, VkImage image, VkFormat
     return view;
 }
 
-static void swapchain_image_setup(Commands& commands, VkImage image) {
-
-    VkImageMemoryBarrier2 barrier = {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
-        .srcStageMask = VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT,
-        .srcAccessMask = VK_ACCESS_2_NONE,
-        .dstStageMask = VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
-        .dstAccessMask = VK_ACCESS_2_NONE,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
-        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
-        .image = image,
-        .subresourceRange =
-            {
-                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-                .baseMipLevel = 0,
-                .levelCount = 1,
-                .baseArrayLayer = 0,
-                .layerCount = 1,
-            },
-    };
-
-    VkDependencyInfo dependency = {
-        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
-        .dependencyFlags = VK_DEPENDENCY_BY_REGION_BIT,
-        .imageMemoryBarrierCount = 1,
-        .pImageMemoryBarriers = &barrier,
-    };
-
-    vkCmdPipelineBarrier2(commands, &dependency);
+template<typename A>
+static void swapchain_image_setup(Barriers<A>& barriers, VkImage image) {
+    barriers.image(image,
+                   VkImageSubresourceRange{
+                       .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                       .baseMipLevel = 0,
+                       .levelCount = 1,
+                       .baseArrayLayer = 0,
+                       .layerCount = 1,
+                   },
+                   VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+                   VK_PIPELINE_STAGE_2_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_2_BOTTOM_OF_PIPE_BIT,
+                   VK_ACCESS_2_NONE, VK_ACCESS_2_NONE);
 }
 
 } // namespace rvk::impl
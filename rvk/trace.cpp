@@ -0,0 +1,161 @@
+
+#include <imgui/imgui.h>
+
+#include "device.h"
+#include "trace.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+// Set during startup and shutdown, before and after other threads use rvk.
+static Event_Ring* active_ring = null;
+
+static Thread::Atomic next_thread_track;
+
+static u32 thread_track() {
+    static thread_local u32 track = static_cast<u32>(next_thread_track.incr());
+    return track;
+}
+
+static void append_escaped(Vec<u8, Alloc>& json, String_View text) {
+    for(u64 i = 0; i < text.length(); i++) {
+        u8 c = static_cast<u8>(text.data()[i]);
+        if(c == '"' || c == '\\') json.push(u8{'\\'});
+        json.push(move(c));
+    }
+}
+
+template<typename... Args>
+static void append(Vec<u8, Alloc>& json, String_View fmt, const Args&... args) {
+    auto text = format<Alloc>(fmt, args...);
+    String_View view = text.view();
+    for(u64 i = 0; i < view.length(); i++) json.push(static_cast<u8>(view.data()[i]));
+}
+
+Event_Ring* Event_Ring::active() {
+    return active_ring;
+}
+
+void Event_Ring::activate(Event_Ring* ring) {
+    active_ring = ring;
+}
+
+Event_Ring::Event_Ring(u64 capacity) {
+    u64 size = 1;
+    while(size < capacity) size <<= 1;
+    mask = size - 1;
+    slots = Vec<Slot, Alloc>::make(size);
+    info("[rvk] Recording up to % trace events.", size);
+}
+
+void Event_Ring::imgui() {
+    using namespace ImGui;
+    u64 recorded = static_cast<u64>(head.load());
+    Text("Events: %lu / %lu | Recorded: %lu", Math::min(recorded, mask + 1), mask + 1, recorded);
+}
+
+void Event_Ring::cpu(String_View name, Profile::Time_Point begin, Profile::Time_Point end) {
+    record(Trace_Event{.name = name, .begin = begin, .end = end, .track = thread_track()});
+}
+
+void Event_Ring::gpu(String_View name, Queue_Family family, u32 queue,
+                     Profile::Time_Point begin, Profile::Time_Point end) {
+    record(Trace_Event{
+        .name = name,
+        .begin = begin,
+        .end = end,
+        .track = (static_cast<u32>(family) << 16) | (queue & 0xffff),
+        .gpu = true,
+    });
+}
+
+void Event_Ring::record(Trace_Event event) {
+    u64 index = static_cast<u64>(head.incr() - 1);
+    Slot& slot = slots[index & mask];
+
+    i64 writing = static_cast<i64>(index * 2 + 1);
+    i64 sequence = slot.sequence.load();
+    if((sequence & 1) || sequence >= writing) return;
+    if(slot.sequence.compare_and_swap(sequence, writing) != sequence) return;
+
+    slot.name_data.store(reinterpret_cast<i64>(event.name.data()));
+    slot.name_length.store(static_cast<i64>(event.name.length()));
+    slot.begin.store(static_cast<i64>(event.begin));
+    slot.end.store(static_cast<i64>(event.end));
+    slot.track.store(static_cast<i64>(event.track) | (event.gpu ? i64{1} << 32 : 0));
+    slot.sequence.store(writing + 1);
+}
+
+bool Event_Ring::dump(String_View path) {
+
+    Profile::Time_Point start = Profile::timestamp();
+
+    u64 end = static_cast<u64>(head.load());
+    u64 begin = end > mask + 1 ? end - (mask + 1) : 0;
+
+    Vec<Trace_Event, Alloc> events(end - begin);
+    for(u64 i = begin; i < end; i++) {
+        Slot& slot = slots[i & mask];
+        i64 sequence = static_cast<i64>(i * 2 + 2);
+        if(slot.sequence.load() != sequence) continue;
+        i64 track = slot.track.load();
+        Trace_Event event = {
+            .name = String_View{reinterpret_cast<const char*>(slot.name_data.load()),
+                                static_cast<u64>(slot.name_length.load())},
+            .begin = static_cast<Profile::Time_Point>(slot.begin.load()),
+            .end = static_cast<Profile::Time_Point>(slot.end.load()),
+            .track = static_cast<u32>(track),
+            .gpu = (track >> 32) != 0,
+        };
+        if(slot.sequence.load() != sequence) continue;
+        events.push(event);
+    }
+
+    Profile::Time_Point base = RPP_UINT64_MAX;
+    for(auto& event : events) base = Math::min(base, event.begin);
+
+    Vec<u8, Alloc> json(Math::max(events.length(), u64{64}) * 96);
+    append(json, "{\"traceEvents\":[\n"_v);
+    append(json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":0,"
+                 "\"args\":{\"name\":\"CPU\"}},\n"_v);
+    append(json, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+                 "\"args\":{\"name\":\"GPU\"}}"_v);
+
+    // Name the track of each queue that has events.
+    String_View families[] = {"Graphics"_v, "Present"_v, "Compute"_v, "Transfer"_v};
+    Vec<u32, Alloc> tracks;
+    for(auto& event : events) {
+        if(!event.gpu) continue;
+        bool found = false;
+        for(u32 track : tracks) found = found || track == event.track;
+        if(found) continue;
+        tracks.push(u32{event.track});
+        append(json,
+               ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%,"
+               "\"args\":{\"name\":\"% %\"}}"_v,
+               event.track, families[(event.track >> 16) & 3], event.track & 0xffff);
+    }
+
+    // Timestamps are in microseconds relative to the oldest event.
+    for(auto& event : events) {
+        append(json, ",\n{\"name\":\""_v);
+        append_escaped(json, event.name);
+        append(json, "\",\"ph\":\"X\",\"pid\":%,\"tid\":%,\"ts\":%,\"dur\":%}"_v,
+               event.gpu ? 1 : 0, event.track, Profile::ms(event.begin - base) * 1000.0,
+               Profile::ms(event.end - event.begin) * 1000.0);
+    }
+    append(json, "\n]}\n"_v);
+
+    if(!Files::write(path, Slice<const u8>{json.data(), json.length()})) {
+        warn("[rvk] Failed to write trace to %.", path);
+        return false;
+    }
+
+    Profile::Time_Point done = Profile::timestamp();
+    info("[rvk] Wrote % trace events to % in %ms.", events.length(), path,
+         Profile::ms(done - start));
+    return true;
+}
+
+} // namespace rvk::impl
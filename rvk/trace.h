@@ -0,0 +1,97 @@
+
+#pragma once
+
+#include <rpp/base.h>
+
+#include "fwd.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+// An event on a CPU thread's track, or on a queue's track when gpu is set. Queue tracks hold
+// the family in the high 16 bits and the queue index in the low 16 bits.
+struct Trace_Event {
+    String_View name;
+    Profile::Time_Point begin = 0;
+    Profile::Time_Point end = 0;
+    u32 track = 0;
+    bool gpu = false;
+};
+
+// Keeps the most recent events in a fixed size ring that can be written out as Chrome trace
+// JSON. Recording is lock-free: a writer takes an index with one atomic increment, then claims
+// its slot by swapping the slot's sequence to odd, writes the event, and publishes it by making
+// the sequence even. A writer whose slot is being written or already holds a newer event drops
+// its event. Event fields are atomics, so a dump reading a slot that is being overwritten sees
+// the sequence change and skips it. Event names are not copied and must outlive the ring.
+struct Event_Ring {
+
+    ~Event_Ring() = default;
+
+    Event_Ring(const Event_Ring&) = delete;
+    Event_Ring& operator=(const Event_Ring&) = delete;
+    Event_Ring(Event_Ring&&) = delete;
+    Event_Ring& operator=(Event_Ring&&) = delete;
+
+    // The ring that rvk's own scopes record into, or null if tracing is disabled.
+    static Event_Ring* active();
+    static void activate(Event_Ring* ring);
+
+    void imgui();
+
+    void cpu(String_View name, Profile::Time_Point begin, Profile::Time_Point end);
+    void gpu(String_View name, Queue_Family family, u32 queue, Profile::Time_Point begin,
+             Profile::Time_Point end);
+
+    // Writes the events currently in the ring to path.
+    [[nodiscard]] bool dump(String_View path);
+
+private:
+    explicit Event_Ring(u64 capacity);
+    friend struct Arc<Event_Ring, Alloc>;
+
+    // Only created while no writer can access the ring.
+    struct Slot {
+        Slot() = default;
+        Slot(Slot&& src) : sequence(src.sequence.load()) {
+        }
+
+        // Twice the event index plus one while it is being written, and plus two once written.
+        Thread::Atomic sequence;
+        Thread::Atomic name_data;
+        Thread::Atomic name_length;
+        Thread::Atomic begin;
+        Thread::Atomic end;
+        // The track in the low 32 bits and whether it is a GPU track in bit 32.
+        Thread::Atomic track;
+    };
+
+    void record(Trace_Event event);
+
+    u64 mask = 0;
+    Vec<Slot, Alloc> slots;
+    Thread::Atomic head;
+};
+
+// Records a CPU event covering its lifetime into the active ring, if any.
+struct Event_Scope {
+    explicit Event_Scope(String_View name) : name(name), ring(Event_Ring::active()) {
+        if(ring) begin = Profile::timestamp();
+    }
+    ~Event_Scope() {
+        if(ring) ring->cpu(name, begin, Profile::timestamp());
+    }
+
+    Event_Scope(const Event_Scope&) = delete;
+    Event_Scope& operator=(const Event_Scope&) = delete;
+    Event_Scope(Event_Scope&&) = delete;
+    Event_Scope& operator=(Event_Scope&&) = delete;
+
+private:
+    String_View name;
+    Event_Ring* ring = null;
+    Profile::Time_Point begin = 0;
+};
+
+} // namespace rvk::impl
@@ -0,0 +1,282 @@
+
+#include <imgui/imgui.h>
+
+#include "rvk.h"
+#include "upload.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+static constexpr u64 max_free_chunks = 4;
+
+static u64 lcm(u64 a, u64 b) {
+    u64 x = a, y = b;
+    while(y) {
+        u64 t = x % y;
+        x = y;
+        y = t;
+    }
+    return a / x * b;
+}
+
+Uploader::Uploader(Arc<Device, Alloc> D, Arc<Timeline_Waiter, Alloc> W,
+                   Arc<Command_Pool_Manager<Queue_Family::transfer>, Alloc> P,
+                   Arc<Memory_Pool, Alloc> M, u64 chunk_size)
+    : device(move(D)), waiter(move(W)), transfer_pool(move(P)), memory(move(M)),
+      chunk_size(chunk_size) {
+}
+
+Uploader::~Uploader() {
+    for(auto& batch : pending) {
+        batch->fence.wait();
+    }
+    pending.clear();
+    if(uploaded_batches) {
+        info("[rvk] Uploaded %mb in % batch(es).", uploaded_bytes / Math::MB(1),
+             uploaded_batches);
+    }
+}
+
+void Uploader::imgui() {
+    using namespace ImGui;
+    Thread::Lock lock{mutex};
+    Text("Chunk: %lumb | Free chunks: %lu | Pending batches: %lu", chunk_size / Math::MB(1),
+         free_chunks.length(), pending.length());
+    Text("Queued: %lukb in %lu job(s)", queued_bytes / 1024, jobs.length());
+    Text("Uploaded: %lumb in %lu batch(es)", uploaded_bytes / Math::MB(1), uploaded_batches);
+}
+
+Opt<u64> Uploader::enqueue(Slice<const u8> data, Buffer& dst, u64 dst_offset) {
+    assert(dst_offset + data.length() <= dst.length());
+    return stage(data, 1,
+                 Job{
+                     .buffer = dst,
+                     .dst_offset = dst_offset,
+                 });
+}
+
+Opt<u64> Uploader::enqueue(Slice<const u8> data, Image& dst, VkImageLayout layout) {
+    assert(data.length() >= dst.linear_size());
+    auto ticket = stage(data, dst.texel_size(),
+                        Job{
+                            .image = dst,
+                            .extent = dst.extent(),
+                            .layout = layout,
+                        });
+    // The batch semaphore orders later accesses after the copy and its final transition.
+    if(ticket.ok()) dst.reset(VK_IMAGE_ASPECT_COLOR_BIT, layout);
+    return ticket;
+}
+
+Opt<u64> Uploader::stage(Slice<const u8> data, u64 texel_size, Job job) {
+
+    // Copies from staging must start at a multiple of the texel size and of 4 bytes, and
+    // should start at a multiple of the device's optimal copy offset alignment.
+    u64 copy_alignment = Math::max(device->copy_offset_alignment(), u64{1});
+    u64 alignment = lcm(lcm(texel_size, 4), copy_alignment);
+
+    Thread::Lock lock{mutex};
+
+    u64 size = data.length();
+    u64 offset = (chunk_used + alignment - 1) / alignment * alignment;
+
+    if(size > chunk_size) {
+        // Oversized uploads get their own staging buffer, which is not recycled.
+        auto buffer = memory->make(size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+        if(!buffer.ok()) {
+            warn("[rvk] Failed to allocate upload staging buffer of size %mb.",
+                 size / Math::MB(1));
+            return {};
+        }
+        Libc::memcpy(buffer->map(), data.data(), size);
+        chunks.push(move(*buffer));
+        chunk_used = chunk_size;
+        job.src_offset = 0;
+    } else {
+        if(chunks.empty() || offset + size > chunk_size) {
+            if(!free_chunks.empty()) {
+                chunks.push(move(free_chunks.back()));
+                free_chunks.pop();
+            } else if(auto buffer = memory->make(chunk_size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+                      buffer.ok()) {
+                chunks.push(move(*buffer));
+            } else {
+                warn("[rvk] Failed to allocate upload chunk of size %mb.",
+                     chunk_size / Math::MB(1));
+                return {};
+            }
+            offset = 0;
+        }
+        Libc::memcpy(chunks.back().map() + offset, data.data(), size);
+        job.src_offset = offset;
+        chunk_used = offset + size;
+    }
+
+    job.chunk = chunks.length() - 1;
+    job.size = size;
+    jobs.push(job);
+    queued_bytes += size;
+
+    return Opt{next_ticket};
+}
+
+Opt<Sem_Ref> Uploader::submit() {
+
+    // The batch is pending from the moment its ticket is taken, so it is not reported as
+    // complete while it is being recorded.
+    Vec<Job, Alloc> batch_jobs;
+    Arc<Batch, Alloc> batch;
+    {
+        Thread::Lock lock{mutex};
+        if(jobs.empty()) return {};
+        batch = Arc<Batch, Alloc>::make(Batch{next_ticket++, Fence{device.dup(), waiter.dup()},
+                                              Semaphore{device.dup()}, Commands{},
+                                              move(chunks)});
+        pending.push(batch.dup());
+        uploaded_bytes += queued_bytes;
+        uploaded_batches++;
+        batch_jobs = move(jobs);
+        chunk_used = 0;
+        queued_bytes = 0;
+    }
+
+    auto cmds = transfer_pool->make();
+
+    Region(R) {
+        // Image layouts change for all jobs at once, before and after the copies. The whole
+        // image is overwritten, so its previous contents can be discarded.
+        Barriers<Mregion<R>> barriers;
+        for(auto& job : batch_jobs) {
+            if(job.buffer) continue;
+            image_barrier(barriers, job.image, VK_IMAGE_ASPECT_COLOR_BIT,
+                          VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                          VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_NONE,
+                          VK_ACCESS_2_TRANSFER_WRITE_BIT);
+        }
+        barriers.flush(cmds);
+
+        for(auto& job : batch_jobs) {
+            VkBuffer src = batch->chunks[job.chunk];
+
+            if(job.buffer) {
+                VkBufferCopy2 region = {
+                    .sType = VK_STRUCTURE_TYPE_BUFFER_COPY_2,
+                    .srcOffset = job.src_offset,
+                    .dstOffset = job.dst_offset,
+                    .size = job.size,
+                };
+                VkCopyBufferInfo2 copy = {
+                    .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_INFO_2,
+                    .srcBuffer = src,
+                    .dstBuffer = job.buffer,
+                    .regionCount = 1,
+                    .pRegions = &region,
+                };
+                vkCmdCopyBuffer2(cmds, &copy);
+                continue;
+            }
+
+            VkBufferImageCopy2 region = {
+                .sType = VK_STRUCTURE_TYPE_BUFFER_IMAGE_COPY_2,
+                .bufferOffset = job.src_offset,
+                .bufferRowLength = 0,
+                .bufferImageHeight = 0,
+                .imageSubresource =
+                    {
+                        .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                        .mipLevel = 0,
+                        .baseArrayLayer = 0,
+                        .layerCount = 1,
+                    },
+                .imageOffset = {0, 0, 0},
+                .imageExtent = job.extent,
+            };
+            VkCopyBufferToImageInfo2 copy = {
+                .sType = VK_STRUCTURE_TYPE_COPY_BUFFER_TO_IMAGE_INFO_2,
+                .srcBuffer = src,
+                .dstImage = job.image,
+                .dstImageLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .regionCount = 1,
+                .pRegions = &region,
+            };
+            vkCmdCopyBufferToImage2(cmds, &copy);
+
+            // Visibility for the consuming queue is provided by the batch semaphore.
+            image_barrier(barriers, job.image, VK_IMAGE_ASPECT_COLOR_BIT,
+                          VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, job.layout,
+                          VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                          VK_ACCESS_2_NONE);
+        }
+        barriers.flush(cmds);
+    }
+
+    cmds.end();
+    batch->cmds = move(cmds);
+
+    auto signal = Sem_Ref{batch->semaphore, VK_PIPELINE_STAGE_2_ALL_TRANSFER_BIT};
+    device->submit(batch->cmds, 0, Slice<const Sem_Ref>{}, Slice{signal}, batch->fence);
+
+    return Opt{Sem_Ref{batch->semaphore, VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT}};
+}
+
+void Uploader::poll() {
+
+    Thread::Lock lock{mutex};
+
+    Vec<Arc<Batch, Alloc>, Alloc> in_flight;
+    for(auto& batch : pending) {
+        if(!batch->fence.ready()) {
+            in_flight.push(move(batch));
+            continue;
+        }
+        for(auto& chunk : batch->chunks) {
+            if(chunk.length() == chunk_size && free_chunks.length() < max_free_chunks) {
+                free_chunks.push(move(chunk));
+            }
+        }
+        drop([batch = move(batch)]() {});
+    }
+    pending = move(in_flight);
+}
+
+bool Uploader::idle() {
+    Thread::Lock lock{mutex};
+    return jobs.empty() && pending.empty();
+}
+
+bool Uploader::complete(u64 ticket) {
+    {
+        Thread::Lock lock{mutex};
+        if(ticket >= next_ticket) return false;
+    }
+    // Batches stay pending from submission until poll() sees their fence.
+    if(auto batch = find(ticket); batch.ok()) {
+        return (*batch)->fence.ready();
+    }
+    return true;
+}
+
+Async::Task<void> Uploader::wait(Async::Pool<>& pool, u64 ticket) {
+    bool queued = false;
+    {
+        Thread::Lock lock{mutex};
+        queued = ticket == next_ticket;
+    }
+    if(queued) submit();
+
+    if(auto batch = find(ticket); batch.ok()) {
+        co_await pool.event((*batch)->fence.event());
+    }
+    co_return;
+}
+
+Opt<Arc<Uploader::Batch, Alloc>> Uploader::find(u64 ticket) {
+    Thread::Lock lock{mutex};
+    for(auto& batch : pending) {
+        if(batch->ticket == ticket) return Opt{batch.dup()};
+    }
+    return {};
+}
+
+} // namespace rvk::impl
@@ -0,0 +1,98 @@
+
+#pragma once
+
+#include <rpp/async.h>
+#include <rpp/base.h>
+#include <rpp/rc.h>
+
+#include "fwd.h"
+
+#include "commands.h"
+#include "memory.h"
+
+namespace rvk::impl {
+
+using namespace rpp;
+
+// Streams data to device resources on the transfer queue. Uploads may be enqueued from any
+// thread; the data is copied into staging chunks from the upload heap right away, and the
+// copies are recorded and submitted as one batch by submit(). Each batch is identified by a
+// ticket, which can be polled, awaited, or waited on by a frame through the batch semaphore.
+// Device resources use concurrent sharing, so no queue family ownership transfer is required.
+// Destinations must not be destroyed or relocated until their batch completes.
+struct Uploader {
+
+    ~Uploader();
+
+    Uploader(const Uploader&) = delete;
+    Uploader& operator=(const Uploader&) = delete;
+    Uploader(Uploader&&) = delete;
+    Uploader& operator=(Uploader&&) = delete;
+
+    void imgui();
+
+    Opt<u64> enqueue(Slice<const u8> data, Buffer& dst, u64 dst_offset);
+    Opt<u64> enqueue(Slice<const u8> data, Image& dst, VkImageLayout layout);
+
+    // Submits the queued uploads. The semaphore is signaled when the copies complete, and
+    // may be passed to wait_frame. Returns nothing if no uploads were queued.
+    Opt<Sem_Ref> submit();
+
+    // Recycles the staging chunks of completed batches. Their semaphores are released through
+    // the deletion queue, since a frame may still be waiting on them.
+    void poll();
+
+    // Whether no uploads are queued or in flight, as of the last poll.
+    bool idle();
+
+    bool complete(u64 ticket);
+    Async::Task<void> wait(Async::Pool<>& pool, u64 ticket);
+
+private:
+    explicit Uploader(Arc<Device, Alloc> device, Arc<Timeline_Waiter, Alloc> waiter,
+                      Arc<Command_Pool_Manager<Queue_Family::transfer>, Alloc> transfer_pool,
+                      Arc<Memory_Pool, Alloc> memory, u64 chunk_size);
+    friend struct Arc<Uploader, Alloc>;
+
+    struct Job {
+        VkBuffer buffer = null;
+        VkImage image = null;
+        VkExtent3D extent = {};
+        VkImageLayout layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        u64 dst_offset = 0;
+        u64 chunk = 0;
+        u64 src_offset = 0;
+        u64 size = 0;
+    };
+
+    struct Batch {
+        u64 ticket = 0;
+        Fence fence;
+        Semaphore semaphore;
+        Commands cmds;
+        Vec<Buffer, Alloc> chunks;
+    };
+
+    Opt<u64> stage(Slice<const u8> data, u64 texel_size, Job job);
+    Opt<Arc<Batch, Alloc>> find(u64 ticket);
+
+    Arc<Device, Alloc> device;
+    Arc<Timeline_Waiter, Alloc> waiter;
+    Arc<Command_Pool_Manager<Queue_Family::transfer>, Alloc> transfer_pool;
+    Arc<Memory_Pool, Alloc> memory;
+    u64 chunk_size = 0;
+
+    Thread::Mutex mutex;
+    Vec<Buffer, Alloc> chunks;
+    Vec<Buffer, Alloc> free_chunks;
+    Vec<Job, Alloc> jobs;
+    Vec<Arc<Batch, Alloc>, Alloc> pending;
+    u64 chunk_used = 0;
+    u64 next_ticket = 1;
+
+    u64 queued_bytes = 0;
+    u64 uploaded_bytes = 0;
+    u64 uploaded_batches = 0;
+};
+
+} // namespace rvk::impl